@@ -0,0 +1,121 @@
+
+#include <string.h>
+
+#include "burst_codec.h"
+
+#define DELTA_ESCAPE 0xf
+
+static bool put_nibble(uint8_t *out, size_t capacity, size_t *nibbles, uint8_t value);
+static size_t delta_length(const uint8_t *in, size_t length);
+
+size_t codec_rle_encode(const uint8_t *in, size_t length, uint8_t *out, size_t capacity){
+    size_t len = 0;
+    for (size_t i = 0; i < length; ){
+        size_t run = 1;
+        while (i + run < length && run < 255 && in[i + run] == in[i]) run++;
+        if (len + 2 > capacity) return 0;
+        out[len++] = run;
+        out[len++] = in[i];
+        i += run;
+    }
+    return len;
+}
+
+size_t codec_delta_encode(const uint8_t *in, size_t length, uint8_t *out, size_t capacity){
+    size_t nibbles = 0;
+    uint8_t prev = 0;
+    for (size_t i = 0; i < length; i++){
+        int8_t delta = (int8_t)(uint8_t)(in[i] - prev);
+        uint8_t zigzag = (uint8_t)(((uint8_t)delta << 1) ^ (uint8_t)(delta >> 7)); // no shift of a negative value
+        prev = in[i];
+        if (zigzag < DELTA_ESCAPE){
+            if (!put_nibble(out, capacity, &nibbles, zigzag)) return 0;
+        } else if (!put_nibble(out, capacity, &nibbles, DELTA_ESCAPE) ||
+            !put_nibble(out, capacity, &nibbles, in[i] >> 4) ||
+            !put_nibble(out, capacity, &nibbles, in[i] & 0xf)){
+            return 0;
+        }
+    }
+    return (nibbles + 1) / 2;
+}
+
+uint8_t codec_encode_best(const uint8_t *in, size_t length, uint8_t *out, size_t capacity,
+    size_t *out_length, unsigned codecs){
+    uint8_t best = CODEC_RAW;
+    size_t best_length = capacity + 1, len;
+    if ((codecs & (1 << CODEC_RLE)) && (len = codec_rle_encode(in, length, out, capacity)) > 0){
+        best = CODEC_RLE;
+        best_length = len;
+    }
+    // measured first, the run-length result in out is overwritten only by a smaller one
+    if ((codecs & (1 << CODEC_DELTA)) && length > 0 && delta_length(in, length) < best_length &&
+        (len = codec_delta_encode(in, length, out, capacity)) > 0){
+        best = CODEC_DELTA;
+        best_length = len;
+    }
+    *out_length = best == CODEC_RAW ? 0 : best_length;
+    return best;
+}
+
+bool codec_decode(uint8_t codec, const uint8_t *in, size_t in_length, uint8_t *out, size_t length){
+    size_t i = 0, o = 0;
+    switch (codec){
+    case CODEC_RAW:
+        if (in_length != length) return false;
+        memcpy(out, in, length);
+        return true;
+    case CODEC_RLE:
+        for (; i + 1 < in_length && o < length; i += 2){
+            if (in[i] == 0 || o + in[i] > length) return false;
+            memset(out + o, in[i + 1], in[i]);
+            o += in[i];
+        }
+        return o == length && i == in_length;
+    case CODEC_DELTA: {
+        uint8_t prev = 0;
+        size_t nibbles = in_length * 2;
+#define NIBBLE(k) ((k) % 2 == 0 ? in[(k) / 2] >> 4 : in[(k) / 2] & 0xf)
+        for (; o < length && i < nibbles; o++){
+            uint8_t zigzag = NIBBLE(i);
+            i++;
+            if (zigzag == DELTA_ESCAPE){
+                if (i + 2 > nibbles) return false;
+                prev = (NIBBLE(i) << 4) | NIBBLE(i + 1);
+                i += 2;
+            } else {
+                prev += (uint8_t)((zigzag >> 1) ^ -(zigzag & 1));
+            }
+            out[o] = prev;
+        }
+#undef NIBBLE
+        return o == length;
+    }
+    default:
+        return false;
+    }
+}
+
+static bool put_nibble(uint8_t *out, size_t capacity, size_t *nibbles, uint8_t value){
+    size_t idx = *nibbles / 2;
+    if (idx >= capacity) return false;
+    if (*nibbles % 2 == 0) {
+        out[idx] = value << 4;
+    } else {
+        out[idx] |= value;
+    }
+    (*nibbles)++;
+    return true;
+}
+
+// bytes codec_delta_encode() produces for the input
+static size_t delta_length(const uint8_t *in, size_t length){
+    size_t nibbles = 0;
+    uint8_t prev = 0;
+    for (size_t i = 0; i < length; i++){
+        int8_t delta = (int8_t)(uint8_t)(in[i] - prev);
+        uint8_t zigzag = (uint8_t)(((uint8_t)delta << 1) ^ (uint8_t)(delta >> 7));
+        nibbles += zigzag < DELTA_ESCAPE ? 1 : 3;
+        prev = in[i];
+    }
+    return (nibbles + 1) / 2;
+}
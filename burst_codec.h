@@ -0,0 +1,31 @@
+
+#ifndef __BURST_CODEC_H__
+#define __BURST_CODEC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Codecs for the payload of MSG_COMPUTE_DATA_BURST_PACKED. Chunks of the fractal contain long
+// runs of equal iteration counts (run-length) and smooth gradients (delta in nibbles).
+
+enum {
+    CODEC_RAW,   // payload is not compressed
+    CODEC_RLE,   // pairs (run length 1-255, value)
+    CODEC_DELTA, // zigzag delta to the previous value, 4 bits each, 0xf nibble escapes a full byte
+    CODEC_NBR
+};
+
+// returns the encoded length or 0 if the result would not fit in capacity
+size_t codec_rle_encode(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+size_t codec_delta_encode(const uint8_t *in, size_t length, uint8_t *out, size_t capacity);
+
+// tries every codec enabled in the bitmask (1 << CODEC_*) and keeps the smallest result,
+// returns CODEC_RAW if none of them is smaller than capacity
+uint8_t codec_encode_best(const uint8_t *in, size_t length, uint8_t *out, size_t capacity,
+    size_t *out_length, unsigned codecs);
+
+// decodes exactly length values to out, returns false on malformed input
+bool codec_decode(uint8_t codec, const uint8_t *in, size_t in_length, uint8_t *out, size_t length);
+
+#endif
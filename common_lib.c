@@ -1,7 +1,14 @@
 
+#include <limits.h>
+#include <sys/inotify.h>
+
 #include "common_lib.h"
 
 static void clear_pipe(int fd);
+static int open_pipe_writer(const char *pipe_name, atomic_bool *quit);
+static int read_buffer_fill(int fd, read_buffer_t *rx);
+static int read_buffer_decode(read_buffer_t *rx, message *out_msg, int *msg_size);
+static int compare_chunk_ids(const void *a, const void *b);
 
 void call_termios(int reset) {
     static struct termios tio, tioOld;
@@ -40,29 +47,29 @@ bool open_pipes(data_t *in, data_t *out, atomic_bool *quit, const char *in_pipe_
     if ((in->fd = io_open_read(in_pipe_name)) == -1){
         pthread_mutex_unlock(&in->lock);
         fprintf(stderr, "ERROR: Cannot open named pipe port '%s'\n", in_pipe_name);
-        atomic_store(quit, true);
+        event_raise_quit(quit);
         call_termios(SET_TERMINAL_TO_DEFAULT);
         exit(ERROR_OPENING_PIPE);
     } else {
         clear_pipe(in->fd);
+        if (in->rx != NULL){ // module has been restarted
+            in->rx->head = in->rx->tail = in->rx->need = 0;
+            in->rx->framed = false;
+            in->rx->loop_fd = -1;
+        }
         pthread_mutex_unlock(&in->lock);
         fprintf(stderr, "INFO: Named pipe port '%s' (FD %d) opened succesfully for reading\n", 
             in_pipe_name, in->fd);
     }
 
     fprintf(stderr, "INFO: Waiting for someone to join pipe port '%s' as a reader\n", out_pipe_name); 
-    int tmp = -1;
-    while (!atomic_load(quit)){
-        tmp = open(out_pipe_name, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_SYNC);
-        if (tmp != -1) break;
-        if (errno != ENXIO) {
-            fprintf(stderr, "ERROR: Cannot open named pipe port '%s': %s\n", 
-                out_pipe_name, strerror(errno));
-                atomic_store(quit, true);
-                exit(ERROR_OPENING_PIPE);
-            }
-        usleep(10000);
-        }
+    int tmp = open_pipe_writer(out_pipe_name, quit);
+    if (tmp == -1 && !atomic_load(quit)) {
+        fprintf(stderr, "ERROR: Cannot open named pipe port '%s': %s\n", 
+            out_pipe_name, strerror(errno));
+        event_raise_quit(quit);
+        exit(ERROR_OPENING_PIPE);
+    }
     if (atomic_load(quit)) {
 #if DEBUG_PIPES
         fprintf(stderr, "DEBUG: open_pipes() is returning early, because of quit flags.\n");
@@ -77,57 +84,98 @@ bool open_pipes(data_t *in, data_t *out, atomic_bool *quit, const char *in_pipe_
     return true;  
 }
 
-bool send_message(int *fd, message msg, pthread_mutex_t *fd_lock){
-    size_t buffer_size = msg.type != MSG_COMPUTE_DATA_BURST ? sizeof(message) : 
-        msg.data.compute_data_burst.length + 5;
-    uint8_t buffer[buffer_size];
-    int msg_size;
+bool send_message(data_t *out, message msg){
+    return send_messages(out, 1, &msg);
+}
 
-    if (!get_message_size(&msg, &msg_size)){ // Only to check validity of message type
-        return false;
+// Serializes all messages and writes them with one writev(). Burst payloads are written straight
+// from the caller's memory, only headers, checksums and frames are serialized to the stack.
+bool send_messages(data_t *out, int count, const message msgs[count]){
+    if (count > SEND_BATCH_MAX){
+        return send_messages(out, SEND_BATCH_MAX, msgs) && 
+            send_messages(out, count - SEND_BATCH_MAX, msgs + SEND_BATCH_MAX);
     }
+    int *fd = &out->fd;
+    pthread_mutex_t *fd_lock = &out->lock;
+    uint8_t headers[count][MESSAGE_HEADER_MAX];
+    uint8_t frames[count][FRAME_HEADER_SIZE + FRAME_TRAILER_SIZE];
+    struct iovec iov[count * (MESSAGE_IOV_MAX + 2)];
+    int iov_count = 0, r;
+    size_t msg_size = 0;
+
+    // framing may be switched on meanwhile, a bare message must not go out after a framed one
+    pthread_mutex_lock(fd_lock);
 
-    if (!fill_message_buf(&msg, buffer, buffer_size, &msg_size)){
-        fprintf(stderr, "ERROR: Serializing message of type %d failed.\n", msg.type);
-        return false;
+#if DEBUG_MUTEX 
+    fprintf(stderr, "DEBUG: Locked mutex of FD %d at %p.\n", *fd, (void *) fd_lock);
+#endif
+    bool framed = atomic_load(&out->framed);
+    for (int i = 0; i < count; i++){
+        int first = framed ? iov_count + 1 : iov_count; // leave room for the frame header
+        if ((r = fill_message_iov(&msgs[i], headers[i], MESSAGE_HEADER_MAX, &iov[first])) == 0){
+            fprintf(stderr, "ERROR: Serializing message of type %d failed.\n", msgs[i].type);
+            pthread_mutex_unlock(fd_lock);
+            return false;
+        }
+        if (framed){
+            uint32_t length = 0, crc = CRC32C_INIT;
+            for (int j = first; j < first + r; j++){
+                length += iov[j].iov_len;
+                crc = crc32c_update(crc, iov[j].iov_base, iov[j].iov_len);
+            }
+            crc = crc32c_final(crc);
+            fill_frame_header(frames[i], length);
+            memcpy(&frames[i][FRAME_HEADER_SIZE], &crc, FRAME_TRAILER_SIZE);
+            iov[iov_count] = (struct iovec){.iov_base = frames[i], .iov_len = FRAME_HEADER_SIZE};
+            iov[first + r] = (struct iovec){.iov_base = &frames[i][FRAME_HEADER_SIZE], .iov_len = FRAME_TRAILER_SIZE};
+            r += 2;
+        }
+        for (int j = iov_count; j < iov_count + r; j++) msg_size += iov[j].iov_len;
+        iov_count += r;
     }
 
     if (*fd < 0){
         fprintf(stderr, "WARN: File descriptor is (%d).\n", *fd);
     }
 
-    pthread_mutex_lock(fd_lock);
+    size_t total_written = 0;
+    ssize_t written;
+    struct iovec *next = iov;
 
-#if DEBUG_MUTEX 
-    fprintf(stderr, "DEBUG: Locked mutex of FD %d at %p.\n", fd, (void *) fd_lock);
-#endif
-    size_t total_written = 0, written;
-    int retries = 1000; 
-
-    while (total_written < (size_t)msg_size && retries-- > 0){
-        written = write(*fd, buffer + total_written, msg_size - total_written);
+    while (total_written < msg_size){
+        written = writev(*fd, next, iov_count - (next - iov));
         if (written > 0){
             total_written += written;
+            while (next->iov_len <= (size_t)written){ // skip fully written vectors
+                written -= next->iov_len;
+                next++;
+                if (next == iov + iov_count) break;
+            }
+            if (next < iov + iov_count){
+                next->iov_base = (uint8_t *)next->iov_base + written;
+                next->iov_len -= written;
+            }
             continue;
         }
-        else if (written == -1 && errno == EAGAIN) {
-            usleep(10); // pipe is full, wait and try again
-            continue;    
+        else if (written == -1 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd ufdw = {.fd = *fd, .events = POLLOUT}; // pipe is full, wait for the reader
+            if (errno == EINTR || poll(&ufdw, 1, SEND_TIMEOUT_MS) > 0) continue;
+            break;
         }
         else if (written == -1 && errno == EPIPE) {
             fprintf(stderr, "WARN: Reader disconected. \n");
             *fd = -1;
             pthread_mutex_unlock(fd_lock);
 #if DEBUG_MUTEX 
-            fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", fd, (void *) fd_lock);
+            fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", *fd, (void *) fd_lock);
 #endif
             return false;
         }
-        else if (written == -1){
-            fprintf(stderr, "ERROR: write() failed. : %s.\n", strerror(errno));
+        else {
+            fprintf(stderr, "ERROR: writev() failed. : %s.\n", strerror(errno));
             pthread_mutex_unlock(fd_lock);
 #if DEBUG_MUTEX 
-            fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", fd, (void *) fd_lock);
+            fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", *fd, (void *) fd_lock);
 #endif
             return false;
         }        
@@ -135,81 +183,210 @@ bool send_message(int *fd, message msg, pthread_mutex_t *fd_lock){
 
     pthread_mutex_unlock(fd_lock);
 #if DEBUG_MUTEX 
-    fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", fd, (void *) fd_lock);
+    fprintf(stderr, "DEBUG: Unlocked mutex of FD %d at %p.\n", *fd, (void *) fd_lock);
 #endif
 
-    if (total_written < (size_t)msg_size){
-        fprintf(stderr, "ERROR: write() wrote only %d/%d after retries.\n", 
-            (int)total_written, msg_size);
+    if (total_written < msg_size){
+        fprintf(stderr, "ERROR: writev() wrote only %d/%d before timeout.\n", 
+            (int)total_written, (int)msg_size);
         return false;
     }
 
 #if DEBUG_MESSAGES 
-    fprintf(stderr, "DEBUG: Message of type %d successfully sent in %d bytes.\n", 
-        msg.type, msg_size);
+    fprintf(stderr, "DEBUG: %d message(s) of type %d successfully sent in %d bytes.\n", 
+        count, msgs[0].type, (int)msg_size);
 #endif
 
     return true;
 }
 
-bool recieve_message(int fd, message *out_msg, int timeout_ms, pthread_mutex_t *fd_lock){
-    uint8_t msg_type;
-    int bytes_read = 0;
+// Both directions of the channel share one connected socket, out gets its own descriptor, so that
+// closing one data_t does not pull the other one from under a thread.
+bool attach_socket(data_t *in, data_t *out, int fd){
+    int out_fd = dup(fd);
+    if (out_fd == -1){
+        fprintf(stderr, "ERROR: dup() of socket failed: %s\n", strerror(errno));
+        close(fd);
+        return false;
+    }
+    pthread_mutex_lock(&in->lock);
+    in->fd = fd;
+    if (in->rx != NULL){ // previous connection
+        in->rx->head = in->rx->tail = in->rx->need = 0;
+        in->rx->framed = false;
+        in->rx->loop_fd = -1;
+    }
+    atomic_store(&in->hangup, false);
+    pthread_mutex_unlock(&in->lock);
+    pthread_mutex_lock(&out->lock);
+    out->fd = out_fd;
+    atomic_store(&out->framed, false);
+    pthread_mutex_unlock(&out->lock);
+    fprintf(stderr, "INFO: Socket connected (FD %d for reading, FD %d for writing).\n", fd, out_fd);
+    return true;
+}
 
-    if (fd == -1){
+void close_channel(data_t *in, data_t *out){
+    pthread_mutex_lock(&in->lock);
+    if (in->fd != -1 && in->rx != NULL) event_loop_remove(&in->rx->loop, in->fd);
+    if (in->fd != -1) close(in->fd);
+    if (in->rx != NULL) in->rx->loop_fd = -1;
+    in->fd = -1;
+    pthread_mutex_unlock(&in->lock);
+    pthread_mutex_lock(&out->lock);
+    if (out->fd != -1) close(out->fd);
+    out->fd = -1;
+    pthread_mutex_unlock(&out->lock);
+}
+
+// Decodes the next complete message from the receive buffer. Many messages are pulled from the fd 
+// by a single read(), so under load most calls return without any syscall.
+bool recieve_message(data_t *in, message *out_msg, int timeout_ms){
+    if (in->fd == -1){
         fprintf(stderr, "ERROR: cannot recieve from fd = -1.\n");
         return false;
     }
-
-    pthread_mutex_lock(fd_lock);
-    if (io_getc_timeout(fd, timeout_ms, &msg_type) == 0){
-        pthread_mutex_unlock(fd_lock);
-        return false; // no message to be read
+    if (in->rx == NULL){
+        if ((in->rx = calloc(1, sizeof(read_buffer_t))) == NULL || (in->rx->buf = malloc(READ_BUFFER_SIZE)) == NULL){
+            fprintf(stderr, "ERROR: Allocation of receive buffer failed.\n");
+            free(in->rx);
+            in->rx = NULL;
+            return false;
+        }
+        in->rx->capacity = READ_BUFFER_SIZE;
+        in->rx->loop_fd = -1;
+        if (!event_loop_init(&in->rx->loop)){
+            free(in->rx->buf);
+            free(in->rx);
+            in->rx = NULL;
+            return false;
+        }
     }
-    bytes_read++;
 
     int msg_size;
-    message tmp = {.type = msg_type}; 
-    if (tmp.type == MSG_COMPUTE_DATA_BURST) {
-        uint8_t burst_lenght[2];
-        if(!io_read_timeout(fd, burst_lenght, 2, timeout_ms)){
-            pthread_mutex_unlock(fd_lock);
-            fprintf(stderr, "ERROR: Couldnt read the 2 bytes to determine the lenght of "
-            "burst message.\n");
+    int r = read_buffer_decode(in->rx, out_msg, &msg_size);
+    if (r == 0){ // incomplete message buffered, wait for more bytes
+        if (in->rx->loop_fd != in->fd){ // channel has been (re)opened
+            if (in->rx->loop_fd != -1) event_loop_remove(&in->rx->loop, in->rx->loop_fd);
+            if (!event_loop_add(&in->rx->loop, in->fd, EVENT_INPUT)) return false;
+            in->rx->loop_fd = in->fd;
+        }
+        if (!(event_loop_wait(&in->rx->loop, timeout_ms) & EVENT_INPUT)){
+            return false; // no message to be read, or quitting
+        }
+        pthread_mutex_lock(&in->lock);
+        r = read_buffer_fill(in->fd, in->rx);
+        pthread_mutex_unlock(&in->lock);
+        if (r <= 0) {
+            if (r == 0) {
+                atomic_store(&in->hangup, true);
+                usleep(DELAY_MS * 1000); // writer has closed the pipe, do not spin
+            }
             return false;
         }
-        bytes_read += 2;
-        memcpy(&tmp.data.compute_data_burst.length, burst_lenght, 2);
-        memcpy(&out_msg->data.compute_data_burst.length,burst_lenght, 2); 
+        atomic_store(&in->hangup, false);
+        r = read_buffer_decode(in->rx, out_msg, &msg_size);
     }
+    if (r != 1) return false;
 
+#if DEBUG_MESSAGES
+    fprintf(stderr, "DEBUG: Message of type %d succesfully recieved in %d bytes.\n", out_msg->type, msg_size);
+#endif
 
-    if (!get_message_size(&tmp, &msg_size)){
-        pthread_mutex_unlock(fd_lock);
-        fprintf(stderr, "ERROR: Recieved message of unknown type: %d.\n", msg_type);
-        return false;
-    }
-    uint8_t buffer[msg_size];
-    buffer[0] = msg_type;
-    if (msg_type == MSG_COMPUTE_DATA_BURST) memcpy(&buffer[1], &tmp.data.compute_data_burst.length, 
-        sizeof(uint16_t));
+    return true;
+}
 
-    if (io_read_timeout(fd, buffer + bytes_read, msg_size - bytes_read, timeout_ms) != 1){
-        return false;
+void read_buffer_destroy(data_t *in){
+    if (in->rx != NULL && in->rx->errors > 0){
+        fprintf(stderr, "WARN: %u corrupted frame(s) were dropped.\n", in->rx->errors);
     }
-
-    pthread_mutex_unlock(fd_lock);
-
-    if (!parse_message_buf(buffer, msg_size, out_msg)){
-        fprintf(stderr, "ERROR: Parsing message of type %d failed.\n", buffer[0]);
-        return false;
+    if (in->rx != NULL){
+        event_loop_destroy(&in->rx->loop);
+        free(in->rx->buf);
     }
+    free(in->rx);
+    in->rx = NULL;
+}
 
-#if DEBUG_MESSAGES
-    fprintf(stderr, "DEBUG: Message of type %d succesfully recieved in %d bytes.\n", out_msg->type, msg_size);
-#endif
+// reads as many bytes as are available, returns number of bytes read, 0 on EOF, -1 on error
+static int read_buffer_fill(int fd, read_buffer_t *rx){
+    if (rx->head > 0 && (rx->tail + GARBAGE_BUFFER_SIZE > rx->capacity || rx->head + rx->need > rx->capacity)){
+        memmove(rx->buf, rx->buf + rx->head, rx->tail - rx->head); // move partial message to front
+        rx->tail -= rx->head;
+        rx->head = 0;
+    }
+    if (rx->need > rx->capacity){ // wide burst of protocol v2 does not fit
+        uint8_t *buf = realloc(rx->buf, rx->need);
+        if (buf == NULL){
+            fprintf(stderr, "ERROR: Allocation of receive buffer failed.\n");
+            exit(ERROR_ALLOCATION);
+        }
+        rx->buf = buf;
+        rx->capacity = rx->need;
+    }
+    ssize_t r = read(fd, rx->buf + rx->tail, rx->capacity - rx->tail);
+    if (r > 0) {
+        rx->tail += r;
+        return r;
+    } 
+    if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return -1;
+    if (r == -1) fprintf(stderr, "ERROR: read() failed: %s\n", strerror(errno));
+    return r;
+}
 
-    return true;
+// returns 1 if message was decoded, 0 if more bytes are needed, -1 if broken message was skipped
+static int read_buffer_decode(read_buffer_t *rx, message *out_msg, int *msg_size){
+    size_t available = rx->tail - rx->head, frame_size;
+    if (available == 0) {
+        rx->head = rx->tail = 0;
+        return 0;
+    }
+    const uint8_t *buf = rx->buf + rx->head;
+    int r;
+    rx->need = 0;
+    if (buf[0] == FRAME_SYNC_0 || rx->framed){ // once framing is on, anything else is garbage
+        if ((r = peek_frame(buf, available, &frame_size)) == 0){
+            if (available >= FRAME_HEADER_SIZE) rx->need = frame_size;
+            return 0;
+        }
+        if (r == 1){
+            rx->framed = true;
+            rx->head += frame_size;
+            *msg_size = frame_size - FRAME_HEADER_SIZE - FRAME_TRAILER_SIZE;
+            buf += FRAME_HEADER_SIZE;
+            int expected;
+            if (peek_message_size(buf, *msg_size, &expected) == 1 && expected == *msg_size &&
+                parse_message_buf(buf, *msg_size, out_msg)){
+                return 1;
+            }
+            fprintf(stderr, "ERROR: Frame holds malformed message of type %d.\n", buf[0]);
+            rx->errors++;
+            return -1;
+        }
+        const uint8_t *next = memchr(buf + 1, FRAME_SYNC_0, available - 1); // resynchronize
+        rx->head = next != NULL ? (size_t)(next - rx->buf) : rx->tail;
+        if (rx->errors++ == 0 || rx->errors % 100 == 0){
+            fprintf(stderr, "WARN: Skipped corrupted frame, %u error(s) so far.\n", rx->errors);
+        }
+        return -1;
+    }
+    r = peek_message_size(buf, available, msg_size);
+    if (r == 0) return 0;
+    if (r == -1){
+        fprintf(stderr, "ERROR: Recieved message of unknown type: %d.\n", buf[0]);
+        rx->head++; // skip the byte
+        return -1;
+    }
+    if (available < (size_t)*msg_size) {
+        rx->need = *msg_size;
+        return 0;
+    }
+    rx->head += *msg_size;
+    if (!parse_message_buf(buf, *msg_size, out_msg)){
+        fprintf(stderr, "ERROR: Parsing message of type %d failed.\n", buf[0]);
+        return -1;
+    }
+    return 1;
 }
 
 void join_all_threads(int N, thread_t threads[N]){
@@ -240,12 +417,50 @@ int create_all_threads(int N, thread_t threads[N]){
     return ret;
 }
 
+// Opening the write end of a fifo fails with ENXIO until somebody opens the read end. inotify
+// reports that open, so the writer sleeps until then instead of retrying.
+static int open_pipe_writer(const char *pipe_name, atomic_bool *quit){
+    int fd = open(pipe_name, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_SYNC);
+    if (fd != -1 || errno != ENXIO) return fd;
+    event_loop_t loop;
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch == -1 || inotify_add_watch(watch, pipe_name, IN_OPEN) == -1 || !event_loop_init(&loop)){
+        fprintf(stderr, "ERROR: Cannot watch named pipe port '%s': %s\n", pipe_name, strerror(errno));
+        if (watch != -1) close(watch);
+        return -1;
+    }
+    event_loop_add(&loop, watch, EVENT_INPUT);
+    uint8_t events[sizeof(struct inotify_event) + NAME_MAX + 1];
+    // reader may have come between the first open() and inotify_add_watch(), so try before waiting
+    while ((fd = open(pipe_name, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_SYNC)) == -1 && errno == ENXIO && 
+        !atomic_load(quit)){
+        if (event_loop_wait(&loop, -1) & EVENT_INPUT){
+            while (read(watch, events, sizeof(events)) > 0) ; // opens of the writers are reported too
+        }
+    }
+    int err = errno;
+    event_loop_destroy(&loop);
+    close(watch);
+    errno = err;
+    return fd;
+}
+
 static void clear_pipe(int fd){ // assumes caller function still holds mutex to the pipe. This function
                                 // is to be called right after a pipe was opened for reading
     uint8_t garbage[GARBAGE_BUFFER_SIZE];
     int r;
+    int flags = fcntl(fd, F_GETFL);
 
+    // writer may already be there with nothing written, io_open_read() left the fd blocking
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     while ((r = read(fd, garbage, sizeof(garbage))) > 0) ; // clear all leftover data in pipe
+    fcntl(fd, F_SETFL, flags);
+}
+
+// queues hold chunk requests, the chunk id tells them apart
+static int compare_chunk_ids(const void *a, const void *b){
+    uint32_t cid_a = ((const message *)a)->data.compute.cid, cid_b = ((const message *)b)->data.compute.cid;
+    return (cid_a > cid_b) - (cid_a < cid_b);
 }
 
 void queue_create(queue_t *queue){
@@ -255,6 +470,7 @@ void queue_create(queue_t *queue){
         exit(ERROR_ALLOCATION);
     }
     setClear(queue->q, free);
+    setCompare(queue->q, compare_chunk_ids);
     pthread_mutex_init(&queue->lock, NULL);
 }
 
@@ -280,6 +496,13 @@ void queue_push(queue_t *queue, void *entry){
     pthread_mutex_unlock(&queue->lock);
 }
 
+bool queue_erase(queue_t *queue, void *entry){
+    pthread_mutex_lock(&queue->lock);
+    bool erased = erase(queue->q, entry);
+    pthread_mutex_unlock(&queue->lock);
+    return erased;
+}
+
 void queue_destroy(queue_t *queue){
     pthread_mutex_lock(&queue->lock);
     clear(queue->q);
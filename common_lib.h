@@ -12,6 +12,8 @@
 
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdatomic.h>
@@ -19,11 +21,20 @@
 #include "prg_io_nonblock.h"
 #include "messages.h"
 #include "queue.h"
+#include "shm_frame.h"
+#include "burst_codec.h"
+#include "crc32c.h"
+#include "transport.h"
+#include "event_loop.h"
+#include "tile_cache.h"
 
 #define SET_TERMINAL_TO_RAW 0
 #define SET_TERMINAL_TO_DEFAULT 1
 #define DELAY_MS 10
 #define GARBAGE_BUFFER_SIZE 256
+#define SEND_BATCH_MAX 16      // messages written by one writev()
+#define SEND_TIMEOUT_MS 1000   // how long a writer waits for the reader to drain a full pipe
+#define READ_BUFFER_SIZE (128 * 1024) // initial size, grows up to MAX_MESSAGE_SIZE for wide bursts
 
 #define DEBUG_MESSAGES 0
 #define DEBUG_PIPES 0
@@ -42,9 +53,24 @@ enum {
 
 typedef void *(*thread_fnc_ptr)(void *);
 
+typedef struct {
+    uint8_t *buf;
+    size_t capacity;
+    size_t head; // first byte not yet decoded
+    size_t tail; // end of the bytes read from the fd
+    size_t need; // size of the incomplete message at head, 0 if unknown
+    bool framed; // a valid frame has been received, bare messages are not expected any more
+    unsigned errors; // corrupted frames skipped while resynchronizing
+    event_loop_t loop; // reader blocks here on the fd and the quit event
+    int loop_fd; // fd in the loop, -1 after the channel has been (re)opened
+} read_buffer_t;
+
 typedef struct {
     pthread_mutex_t lock;
     int fd; // file descriptor
+    read_buffer_t *rx; // receive buffer, allocated by the first recieve_message() call
+    atomic_bool framed; // send messages in CRC32C frames (FEATURE_FRAMING)
+    atomic_bool hangup; // the other side has closed the channel
 } data_t;
 
 typedef struct {
@@ -62,8 +88,12 @@ typedef struct {
 
 void call_termios(int reset);
 bool open_pipes(data_t *in, data_t *out, atomic_bool *quit, const char *in_pipe_name, const char *out_pipe_name);
-bool send_message(int *fd, message msg, pthread_mutex_t *fd_lock);
-bool recieve_message(int fd, message *out_msg, int timeout_ms, pthread_mutex_t *fd_lock);
+bool attach_socket(data_t *in, data_t *out, int fd);
+void close_channel(data_t *in, data_t *out);
+bool send_message(data_t *out, message msg);
+bool send_messages(data_t *out, int count, const message msgs[count]);
+bool recieve_message(data_t *in, message *out_msg, int timeout_ms);
+void read_buffer_destroy(data_t *in);
 void join_all_threads(int N, thread_t threads[N]);
 int create_all_threads(int N, thread_t threads[N]);
 
@@ -71,6 +101,7 @@ void queue_create(queue_t *queue);
 void queue_clear(queue_t *queue);
 void* queue_pop(queue_t *queue);
 void queue_push(queue_t *queue, void *entry);
+bool queue_erase(queue_t *queue, void *entry);
 void queue_destroy(queue_t *queue);
 int queue_size(queue_t *queue);
 
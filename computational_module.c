@@ -14,15 +14,20 @@ static void *read_user_input(void *arg);
 static void *compute_boss(void *arg);
 static void *compute_worker(void *arg);
 static void cleanup(void);
-static void send_version_message(int *fd, pthread_mutex_t *fd_lock);
-static void send_ok_message(int *fd, pthread_mutex_t *fd_lock);
-static void send_error_message(int *fd, pthread_mutex_t *fd_lock);
-static void send_abort_message(int *fd, pthread_mutex_t *fd_lock);
-static void send_done_message(int *fd, pthread_mutex_t *fd_lock);
+static void send_version_message(data_t *out);
+static void send_ok_message(data_t *out);
+static void send_error_message(data_t *out);
+static void send_abort_message(data_t *out);
+static void send_compute_data(data_compute_worker_t *data, uint32_t cid, uint32_t length, uint8_t *iters, 
+    int slot);
+static void send_capabilities_message(data_t *out);
+static void send_startup_message(thread_shared_data_t *data);
+static bool accept_app(thread_shared_data_t *data);
 static thread_shared_data_t *thread_shared_data_init(void);
-static data_compute_boss_t *data_compute_boss_init(atomic_bool *abort, queue_t *queue_of_work, 
-    uint8_t num_of_workers, data_t *module_to_app);
-static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app);
+static data_compute_boss_t *data_compute_boss_init(thread_shared_data_t *shared, uint8_t num_of_workers);
+static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app, int boss_wake);
+static void request_abort(thread_shared_data_t *data);
+static void cancel_chunk(thread_shared_data_t *data, uint32_t cid);
 static void destroy_shared_data(thread_shared_data_t *data, data_compute_boss_t *boss_data);
 static uint8_t compute_one_pixel(complex double z);
 static void print_help(void);
@@ -37,6 +42,11 @@ static double complex c = 0.0 + 0.0 * I; // constant for calculation
 static double complex d = 0.0 + 0.0 * I; // increment
 static uint8_t n = -1;
 static atomic_bool quit;
+static shm_frame_t *shm_frame = NULL;  // created at startup, used once the app accepts FEATURE_SHM_FRAME
+static atomic_bool shm_frame_enabled;
+static atomic_uint packed_codecs; // bitmask of 1 << CODEC_* accepted by the app
+static atomic_uint protocol_version; // negotiated by MSG_FEATURES, 1 until then
+static tile_cache_t *tile_cache = NULL; // chunks computed before are read back from it
 
 int main(int argc, char *argv[]) {
     computational_module_init();
@@ -45,8 +55,7 @@ int main(int argc, char *argv[]) {
     uint8_t num_of_non_workers = 3, num_of_workers = (argc >= 2 && (tmp = atoi(argv[1])) > 0 && tmp <= 8) ? 
         tmp : DEFAULT_NUM_OF_WORKERS;
     thread_shared_data_t *data = thread_shared_data_init();
-    data_compute_boss_t *data_boss = data_compute_boss_init(&data->abort, data->queue_of_work, 
-        num_of_workers, &data->module_to_app);
+    data_compute_boss_t *data_boss = data_compute_boss_init(data, num_of_workers);
 
     thread_t threads[num_of_non_workers + num_of_workers];        
     threads[0].thread_name = "Pipe",  threads[0].thread_function = read_from_pipe,  threads[0].data = data; 
@@ -64,83 +73,167 @@ int main(int argc, char *argv[]) {
         threads[num_of_non_workers + i].data = data_boss->array_of_ptrs_to_worker_data[i];
     }
     
+    const char *app_to_module_pipe_name = argc >= 3 ? argv[2] : "/tmp/computational_module.in";
+    const char *module_to_app_pipe_name = argc >= 4 ? argv[3] : "/tmp/computational_module.out";
+    int transport = transport_kind(app_to_module_pipe_name);
+    data->num_of_workers = num_of_workers;
+    data->channel = app_to_module_pipe_name;
+    tile_cache = tile_cache_open(argc >= 5 ? argv[4] : tile_cache_default_path());
+    
     if ((ret = create_all_threads(num_of_non_workers + num_of_workers, threads)) != ERROR_OK) return ret;
 
-    const char *app_to_module_pipe_name = argc >= 4 ? argv[2] : "/tmp/computational_module.in";
-    const char *module_to_app_pipe_name = argc >= 4 ? argv[3] : "/tmp/computational_module.out";
+    char spawned_name[32];
+    transport_spawn_name(getpid(), spawned_name, sizeof(spawned_name));
+
+    if (transport != TRANSPORT_KIND_TCP){ // the app on another host cannot map the segment
+        shm_frame = shm_frame_create(transport == TRANSPORT_KIND_PIPE ? module_to_app_pipe_name : 
+            transport == TRANSPORT_KIND_FD ? spawned_name : app_to_module_pipe_name);
+    }
 
-    if (open_pipes(&data->app_to_module, &data->module_to_app, &quit, 
-        app_to_module_pipe_name, module_to_app_pipe_name) && sizeof(startup_message) + 1 <= STARTUP_MSG_LEN){
-        message msg = {.type = MSG_STARTUP};
-        memcpy(msg.data.startup.message, startup_message, sizeof(startup_message));  
-        msg.data.startup.message[sizeof(startup_message)] = num_of_workers;
-        send_message(&data->module_to_app.fd, msg, &data->module_to_app.lock);
+    if (transport == TRANSPORT_KIND_PIPE){
+        if (open_pipes(&data->app_to_module, &data->module_to_app, &quit, 
+            app_to_module_pipe_name, module_to_app_pipe_name)){
+            send_startup_message(data);
+        }
+    } else if (transport == TRANSPORT_KIND_FD){ // started by the app, the socket is connected already
+        int fd = transport_inherited(app_to_module_pipe_name);
+        if (fd == -1 || !attach_socket(&data->app_to_module, &data->module_to_app, fd)){
+            event_raise_quit(&quit);
+            ret = ERROR_OPENING_PIPE;
+        } else {
+            send_startup_message(data);
+        }
+    } else if ((data->listen_fd = transport_listen(app_to_module_pipe_name)) == -1){
+        event_raise_quit(&quit);
+        ret = ERROR_OPENING_PIPE;
+    } else if (accept_app(data)){
+        send_startup_message(data);
     }
+    event_signal(data->channel_ready);
 
     join_all_threads(num_of_non_workers + num_of_workers, threads);
     for (int i = 0; i < num_of_workers; i++) free(threads[i + num_of_non_workers].thread_name);
 
+    close_channel(&data->app_to_module, &data->module_to_app);
+    transport_close_listener(data->listen_fd, data->channel);
     destroy_shared_data(data, data_boss);
+    shm_frame_destroy(shm_frame);
+    tile_cache_close(tile_cache);
 
-    return ERROR_OK;
+    return ret;
 }
 
 static void *read_from_pipe(void *arg){
     thread_shared_data_t *data = (thread_shared_data_t *)arg;
-    
+    event_loop_t loop;
+    if (!event_loop_init(&loop)){
+        event_raise_quit(&quit);
+        return NULL;
+    }
+    event_loop_add(&loop, data->channel_ready, EVENT_WAKE);
     while (data->module_to_app.fd == -1 && !atomic_load(&quit)){
-        usleep(DELAY_MS);
-    } ; // waiting for pipe to be joined
+        event_loop_wait(&loop, -1); // waiting for pipe to be joined
+    }
+    event_loop_remove(&loop, data->channel_ready);
+    event_loop_add(&loop, data->abort_done, EVENT_WAKE);
             
     message msg;
 
     while(!atomic_load(&quit)){
-        if (recieve_message(data->app_to_module.fd, &msg, DELAY_MS, &data->app_to_module.lock)){
+        if (data->listen_fd != -1 && atomic_load(&data->app_to_module.hangup)){ // serve the next app
+            fprintf(stderr, "INFO: App has disconnected.\n");
+            request_abort(data);
+            close_channel(&data->app_to_module, &data->module_to_app);
+            if (accept_app(data)) send_startup_message(data);
+            continue;
+        }
+        if (atomic_load(&data->app_to_module.hangup) && transport_kind(data->channel) == TRANSPORT_KIND_FD){
+            fprintf(stderr, "INFO: App has exited, so does the module it started.\n");
+            event_raise_quit(&quit);
+            break;
+        }
+        if (recieve_message(&data->app_to_module, &msg, -1)){
             switch (msg.type)
             {
             case MSG_GET_VERSION:
                 if (data->app_to_module.fd == -1) break;
                 fprintf(stderr, "INFO: App requested version.\n");
-                send_version_message(&data->module_to_app.fd, &data->module_to_app.lock);
+                send_version_message(&data->module_to_app);
                 break;
             case MSG_SET_COMPUTE:
-                atomic_store(&data->abort, true); // abort ongoing calculation with old values. Boss thread will clear queue.
+                request_abort(data); // abort ongoing calculation with old values. Boss thread will clear queue.
                 c = msg.data.set_compute.c_re + msg.data.set_compute.c_im * I; 
                 d = msg.data.set_compute.d_re + msg.data.set_compute.d_im * I;
                 n = msg.data.set_compute.n;
                 fprintf(stderr, "INFO: App set new computation data. c = %.4f %+.4fi, d = %.4f %+.4fi, n = %d\n", 
                     creal(c), cimag(c), creal(d), cimag(d), n);
                 if (data->app_to_module.fd == -1) break;
-                send_ok_message(&data->module_to_app.fd, &data->module_to_app.lock);
+                send_ok_message(&data->module_to_app);
                 break;
             case MSG_COMPUTE:
+            case MSG_COMPUTE_V2:
+                if (msg.type == MSG_COMPUTE_V2 && atomic_load(&protocol_version) < 2){
+                    fprintf(stderr, "WARN: App sent a protocol v2 request without agreeing on v2.\n");
+                    send_error_message(&data->module_to_app);
+                    break;
+                }
                 if (n <= 0 || (creal(c) == 0.0 && cimag(c) == 0.0) || creal(d) == 0.0 || cimag(d) == 0.0){
                     fprintf(stderr, "WARN: Computation data has not been set properly.\n");
                     if (data->app_to_module.fd == -1) break;
-                    send_error_message(&data->module_to_app.fd, &data->module_to_app.lock);
+                    send_error_message(&data->module_to_app);
                     break;
                 }
+                if ((uint32_t)msg.data.compute.n_re * msg.data.compute.n_im > MAX_CHUNK_PIXELS){
+                    fprintf(stderr, "WARN: Chunk %u of %dx%d pixels is too large.\n", msg.data.compute.cid,
+                        msg.data.compute.n_re, msg.data.compute.n_im);
+                    send_error_message(&data->module_to_app);
+                    break;
+                }
+                msg.type = MSG_COMPUTE; // workers do not care about the wire format
                 message *msg_copy = malloc(sizeof(message));
                 if (msg_copy == NULL){
                     fprintf(stderr, "FATAL ERROR: Allocation failed.\n");
                     exit(ERROR_ALLOCATION);
                 } 
-                while (atomic_load(&data->abort)) {
-                    usleep(DELAY_MS); // Boss thread is aborting
+                while (atomic_load(&data->abort) && !atomic_load(&quit)) {
+                    event_loop_wait(&loop, -1); // Boss thread is aborting
+                    event_clear(data->abort_done);
                 }
                 *msg_copy = msg;
                 queue_push(data->queue_of_work, msg_copy);
-                send_ok_message(&data->module_to_app.fd, &data->module_to_app.lock);
+                event_signal(data->boss_wake);
+                send_ok_message(&data->module_to_app);
+                break;
+            case MSG_CANCEL:
+                if (atomic_load(&protocol_version) < 2) break; // accepted only with v2, v1 chunk ids repeat
+                cancel_chunk(data, msg.data.cancel.chunk_id);
                 break;
             case MSG_ABORT:
                 if (data->app_to_module.fd == -1) break;
                 fprintf(stderr, "INFO: App requested abortion.\n");
-                atomic_store(&data->abort, true);
-                send_abort_message(&data->module_to_app.fd, &data->module_to_app.lock);
+                request_abort(data);
+                send_abort_message(&data->module_to_app);
                 break;
             case MSG_QUIT:
                 fprintf(stderr, "INFO: Quiting module.\n");
-                atomic_store(&quit, true);
+                event_raise_quit(&quit);
+                break;
+            case MSG_GET_CAPABILITIES:
+                if (data->app_to_module.fd == -1) break;
+                send_capabilities_message(&data->module_to_app);
+                break;
+            case MSG_FEATURES:
+                atomic_store(&protocol_version, msg.data.features.version > 1 ? 
+                    msg.data.features.version : 1);
+                atomic_store(&shm_frame_enabled, shm_frame != NULL && 
+                    (msg.data.features.features & FEATURE_SHM_FRAME));
+                atomic_store(&packed_codecs, 
+                    ((msg.data.features.features & FEATURE_CODEC_RLE) ? 1 << CODEC_RLE : 0) |
+                    ((msg.data.features.features & FEATURE_CODEC_DELTA) ? 1 << CODEC_DELTA : 0));
+                atomic_store(&data->module_to_app.framed, msg.data.features.features & FEATURE_FRAMING);
+                fprintf(stderr, "INFO: App accepted features 0x%02x and protocol v%u. Shared frame is %s.\n", 
+                    msg.data.features.features, atomic_load(&protocol_version), 
+                    atomic_load(&shm_frame_enabled) ? "used" : "not used");
                 break;
             default:
                 fprintf(stderr, "WARN: App sent message of unexpected (but defined) type.\n");
@@ -148,6 +241,7 @@ static void *read_from_pipe(void *arg){
             }
         }
     }
+    event_loop_destroy(&loop);
     return NULL; 
 } 
 
@@ -156,24 +250,30 @@ static void *read_user_input(void *arg){
     thread_shared_data_t *data = (thread_shared_data_t *)arg;    
     uint8_t c;
     int r;
+    event_loop_t loop;
+    if (transport_kind(data->channel) == TRANSPORT_KIND_FD) return NULL; // keyboard belongs to the app
+    if (!event_loop_init(&loop) || !event_loop_add(&loop, STDIN_FILENO, EVENT_INPUT)) return NULL;
     while (!atomic_load(&quit)){
-        if ((r = io_getc_timeout(STDIN_FILENO, DELAY_MS, &c)) == -1){
+        if (!(event_loop_wait(&loop, -1) & EVENT_INPUT)) continue;
+        if ((r = io_getc_timeout(STDIN_FILENO, 0, &c)) == -1){
             fprintf(stderr, "ERROR: io_getc_timeout() from stdin failed: %s\n", strerror(errno));
+            event_loop_remove(&loop, STDIN_FILENO); // closed stdin stays readable, wait for quit only
             continue;
         } else if (r == 0){
-            continue; // no character read
+            event_loop_remove(&loop, STDIN_FILENO); // ready but nothing to read, stdin hung up
+            continue;
         }
         switch (c)
         {
         case 'q':
-            atomic_store(&quit, true);
+            event_raise_quit(&quit);
             fprintf(stderr, "INFO: Quiting module.\n");
             break;
         case 'a':
             fprintf(stderr, "INFO: Aborting.\n");
-            atomic_store(&data->abort, true);        
+            request_abort(data);
             if (data->app_to_module.fd == -1) break;
-            send_abort_message(&data->module_to_app.fd, &data->module_to_app.lock);
+            send_abort_message(&data->module_to_app);
             break;
         case 'h':
             print_help();
@@ -182,14 +282,20 @@ static void *read_user_input(void *arg){
             break;
         }
     }
+    event_loop_destroy(&loop);
     return NULL;
 }
 
 static void *compute_boss(void *arg){
     data_compute_boss_t *data = (data_compute_boss_t*)arg;
     bool workers_are_ready = false;
+    event_loop_t loop;
+    if (!event_loop_init(&loop) || !event_loop_add(&loop, data->wake, EVENT_WAKE)){
+        event_raise_quit(&quit);
+        return NULL;
+    }
 
-    while (!workers_are_ready){ // wait until all worker threads are ready
+    while (!workers_are_ready && !atomic_load(&quit)){ // wait until all worker threads are ready
         workers_are_ready = true;
         for (int i = 0; i < data->num_of_workers; i++){
             if (data->array_of_ptrs_to_worker_data[i]->is_ready == false){
@@ -197,7 +303,9 @@ static void *compute_boss(void *arg){
                 break;
             }
         }
-        usleep(DELAY_MS);
+        if (workers_are_ready) break;
+        event_loop_wait(&loop, -1); // woken by the worker that gets ready
+        event_clear(data->wake);
     }
 
     while (!atomic_load(&quit)){
@@ -210,11 +318,13 @@ static void *compute_boss(void *arg){
                 }
             }
             atomic_store(data->abort, false); // everyone has been aborted
+            event_signal(data->abort_done);
         }
 
         message *msg = queue_pop(data->queue_of_work);        
-        if (msg == NULL){  // no work
-            usleep(DELAY_MS);
+        if (msg == NULL){  // no work, sleep until some is queued or abort is raised
+            event_loop_wait(&loop, -1);
+            event_clear(data->wake);
             continue;
         }
 
@@ -228,16 +338,24 @@ static void *compute_boss(void *arg){
                 fprintf(stderr, "DEBUG: Giving chunk %d to worker thread %d.\n", msg->data.compute.cid,i);
 #endif                                
                 pthread_mutex_lock(&worker_data->lock);
+                atomic_store(&worker_data->is_busy, true); // worker may not have woken up before next chunk
                 worker_data->work = *msg;
+                worker_data->cid = msg->data.compute.cid; // cancellable from now on
+                atomic_store(&worker_data->cancel, false); // meant for the previous chunk
                 pthread_cond_signal(&worker_data->cond);
                 pthread_mutex_unlock(&worker_data->lock);
                 found_worker = true;
                 break;
             }
-            usleep(DELAY_MS); // no free worker was found, try again later
+            if (!found_worker && !atomic_load(&quit)){ // no free worker was found, wait for one
+                event_loop_wait(&loop, -1);
+                event_clear(data->wake);
+            }
+            if (atomic_load(&quit)) break;
         }
         free(msg);
     }    
+    event_loop_destroy(&loop);
     for (int i = 0; i < data->num_of_workers && !atomic_load(data->abort); i++){  // wake up sleeping workers
         data_compute_worker_t *worker_data = data->array_of_ptrs_to_worker_data[i];
         pthread_mutex_lock(&worker_data->lock);
@@ -250,6 +368,7 @@ static void *compute_boss(void *arg){
 static void *compute_worker(void *arg){
     data_compute_worker_t *data = (data_compute_worker_t *)arg;
     atomic_store(&data->is_ready, true);
+    event_signal(data->boss_wake);
 
     while (!atomic_load(&quit)){
         pthread_mutex_lock(&data->lock);
@@ -268,13 +387,19 @@ static void *compute_worker(void *arg){
         data->work.type = MSG_NBR; // to prevent unwanted calculations 
         pthread_mutex_unlock(&data->lock);
         if (atomic_load(&quit)) break;
-        atomic_store(&data->is_busy, true);        
 
-        uint8_t iters[msg.data.compute.n_re * msg.data.compute.n_im];
+        int length = msg.data.compute.n_re * msg.data.compute.n_im;
+        uint8_t local_iters[length];
+        int slot = atomic_load(&shm_frame_enabled) ? shm_frame_acquire(shm_frame, length) : -1;
+        uint8_t *iters = slot >= 0 ? shm_frame_slot(shm_frame, slot) : local_iters; // compute in place
         complex double lower_left_corner = msg.data.compute.re + msg.data.compute.im * I, z;
+        msg_set_compute setup = {.c_re = creal(c), .c_im = cimag(c), .d_re = creal(d), .d_im = cimag(d), .n = n};
+        tile_key_t key;
+        tile_key_init(&key, &setup, &msg.data.compute);
+        bool cached = tile_cache_lookup(tile_cache, &key, iters, length);
 
-        for (int row = 0, i = 0; row < msg.data.compute.n_im && !atomic_load(&data->abort) 
-            && !atomic_load(&quit); row++){
+        for (int row = 0, i = 0; !cached && row < msg.data.compute.n_im && !atomic_load(&data->abort) 
+            && !atomic_load(&data->cancel) && !atomic_load(&quit); row++){
             for (int col = 0; col < msg.data.compute.n_re && !atomic_load(&data->abort) 
                 && !atomic_load(&quit); col++, i++){
                 z = lower_left_corner + row*cimag(d)*I + col*creal(d);
@@ -282,33 +407,66 @@ static void *compute_worker(void *arg){
             }
         }
 
-        if (atomic_load(&data->abort)){
+        if (atomic_load(&data->abort) || atomic_load(&data->cancel)){
 
 #if DEBUG_MULTITHREADING
             fprintf(stderr, "DEBUG: Worker has aborted computation.\n");
 #endif            
+            shm_frame_release(shm_frame, slot);
             atomic_store(&data->abort, false);
+            atomic_store(&data->cancel, false);
             atomic_store(&data->is_busy, false);
+            event_signal(data->boss_wake);
             continue;
         }
 
-        message output = {.type = MSG_COMPUTE_DATA_BURST, .data.compute_data_burst = {
-            .length = msg.data.compute.n_re * msg.data.compute.n_im, .chunk_id = msg.data.compute.cid, 
-            .iters = iters}};
-
-        send_message(&data->module_to_app->fd, output, &data->module_to_app->lock);
-
-        send_done_message(&data->module_to_app->fd, &data->module_to_app->lock);
+        if (!cached) tile_cache_store(tile_cache, &key, iters, length);
+        send_compute_data(data, msg.data.compute.cid, length, iters, slot);
 
 #if DEBUG_MULTITHREADING
             fprintf(stderr, "DEBUG: Worker has sent burst message and done message.\n");
 #endif 
 
         atomic_store(&data->is_busy, false);
+        event_signal(data->boss_wake);
     }
     return NULL;
 }
 
+// sends either the notification about the filled shared frame slot or the burst, compressed if that
+// is smaller, followed by the done message in the same write
+static void send_compute_data(data_compute_worker_t *data, uint32_t cid, uint32_t length, uint8_t *iters, 
+    int slot){
+    message output[2] = {[1].type = MSG_DONE};
+    uint8_t packed[length], codec;
+    size_t packed_length;
+    if (slot >= 0){
+        shm_frame_publish(shm_frame, slot);
+        output[0].type = MSG_COMPUTE_DATA_SHM;
+        output[0].data.compute_data_shm.chunk_id = cid;
+        output[0].data.compute_data_shm.slot = slot;
+        output[0].data.compute_data_shm.length = length;
+    } else if ((codec = codec_encode_best(iters, length, packed, length - 1, &packed_length,
+        atomic_load(&packed_codecs))) != CODEC_RAW){
+        output[0].type = MSG_COMPUTE_DATA_BURST_PACKED;
+        output[0].data.compute_data_burst_packed.chunk_id = cid;
+        output[0].data.compute_data_burst_packed.codec = codec;
+        output[0].data.compute_data_burst_packed.length = length;
+        output[0].data.compute_data_burst_packed.packed_length = packed_length;
+        output[0].data.compute_data_burst_packed.data = packed;
+    } else {
+        // keep the v1 burst whenever it fits, a v1 app cannot request larger chunks
+        output[0].type = atomic_load(&protocol_version) >= 2 && (cid > UINT8_MAX || length > UINT16_MAX) ? 
+            MSG_COMPUTE_DATA_BURST_V2 : MSG_COMPUTE_DATA_BURST;
+        output[0].data.compute_data_burst.chunk_id = cid;
+        output[0].data.compute_data_burst.length = length;
+        output[0].data.compute_data_burst.iters = iters;
+    }
+    if (!send_messages(data->module_to_app, 2, output)){
+        shm_frame_release(shm_frame, slot); // app will never consume it
+    }
+}
+
 static uint8_t compute_one_pixel(complex double z){
     int i = 0;
     for (; i < n; i++){
@@ -330,6 +488,16 @@ static thread_shared_data_t *thread_shared_data_init(void){
     atomic_store(&data->abort, false);
     data->app_to_module.fd = -1;
     data->module_to_app.fd = -1;
+    data->app_to_module.rx = NULL;
+    data->module_to_app.rx = NULL;
+    atomic_store(&data->app_to_module.framed, false);
+    atomic_store(&data->module_to_app.framed, false);
+    atomic_store(&data->app_to_module.hangup, false);
+    atomic_store(&data->module_to_app.hangup, false);
+    data->listen_fd = -1;
+    data->channel_ready = event_create();
+    data->boss_wake = event_create();
+    data->abort_done = event_create();
     queue_t *queue= malloc(sizeof(queue_t));
     if (queue == NULL){
         fprintf(stderr, "FATAL ERROR: Allocation failed.\n");
@@ -343,15 +511,16 @@ static thread_shared_data_t *thread_shared_data_init(void){
 }
 
 // also initiates data for workers
-static data_compute_boss_t *data_compute_boss_init(atomic_bool *abort, queue_t *queue_of_work, 
-    uint8_t num_of_workers, data_t *module_to_app){
+static data_compute_boss_t *data_compute_boss_init(thread_shared_data_t *shared, uint8_t num_of_workers){
     data_compute_boss_t *data = malloc(sizeof(data_compute_boss_t));
     if (data == NULL){
         fprintf(stderr, "FATAL ERROR: Allocation failed.\n");
         exit(ERROR_ALLOCATION);
     }    
-    data->abort = abort;
-    data->queue_of_work = queue_of_work;
+    data->abort = &shared->abort;
+    data->wake = shared->boss_wake;
+    data->abort_done = shared->abort_done;
+    data->queue_of_work = shared->queue_of_work;
     data->num_of_workers = num_of_workers;
     data_compute_worker_t **workers_data = malloc(sizeof(data_compute_worker_t *) * num_of_workers);
     if (workers_data == NULL){
@@ -359,13 +528,14 @@ static data_compute_boss_t *data_compute_boss_init(atomic_bool *abort, queue_t *
         exit(ERROR_ALLOCATION);
     }
     for (int i = 0; i < num_of_workers; i++) {
-        workers_data[i] = data_compute_worker_init(module_to_app);
+        workers_data[i] = data_compute_worker_init(&shared->module_to_app, shared->boss_wake);
     }
     data->array_of_ptrs_to_worker_data = workers_data;
+    shared->workers = workers_data;
     return data;
 }
 
-static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app){
+static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app, int boss_wake){
     data_compute_worker_t *data = malloc(sizeof(data_compute_worker_t));
     if (data == NULL){
         fprintf(stderr, "FATAL ERROR: Allocation failed.\n");
@@ -373,8 +543,10 @@ static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app){
     }  
     atomic_store(&data->is_ready, false);
     atomic_store(&data->abort, false);
+    atomic_store(&data->cancel, false);
     atomic_store(&data->is_busy, false);
     data->module_to_app = module_to_app;
+    data->boss_wake = boss_wake;
     data->work.type = MSG_NBR;
     data->work.data.compute.n_im = 0;
     data->work.data.compute.n_re = 0; 
@@ -386,9 +558,13 @@ static data_compute_worker_t *data_compute_worker_init(data_t *module_to_app){
 static void destroy_shared_data(thread_shared_data_t *data, data_compute_boss_t *boss_data){
     pthread_mutex_destroy(&data->app_to_module.lock);
     pthread_mutex_destroy(&data->module_to_app.lock);
+    read_buffer_destroy(&data->app_to_module);
     queue_clear(data->queue_of_work);
     free(data->queue_of_work->q);
     free(data->queue_of_work);
+    event_close(data->channel_ready);
+    event_close(data->boss_wake);
+    event_close(data->abort_done);
     free(data);
     for (int i = 0; i < boss_data->num_of_workers; i++){
         pthread_mutex_destroy(&boss_data->array_of_ptrs_to_worker_data[i]->lock);
@@ -403,38 +579,93 @@ static void cleanup(void){
     call_termios(SET_TERMINAL_TO_DEFAULT);
 }
 
-static void send_version_message(int *fd, pthread_mutex_t *fd_lock){
+static void send_version_message(data_t *out){
     message msg = {.type = MSG_VERSION, .data.version.major = major, 
         .data.version.minor = minor, .data.version.patch = patch};
-    send_message(fd, msg, fd_lock);
+    send_message(out, msg);
 }
     
-static void send_ok_message(int *fd, pthread_mutex_t *fd_lock){
+static void send_ok_message(data_t *out){
     message msg = {.type = MSG_OK};
-    send_message(fd, msg, fd_lock);
+    send_message(out, msg);
 }
 
-static void send_error_message(int *fd, pthread_mutex_t *fd_lock){
+static void send_error_message(data_t *out){
     message msg = {.type = MSG_ERROR};
-    send_message(fd, msg, fd_lock);
+    send_message(out, msg);
 }
 
-static void send_abort_message(int *fd, pthread_mutex_t *fd_lock){
+static void send_abort_message(data_t *out){
     message msg = {.type = MSG_ABORT};
-    send_message(fd, msg, fd_lock);
+    send_message(out, msg);
+}
+
+static void send_startup_message(thread_shared_data_t *data){
+    if (sizeof(startup_message) + 3 > STARTUP_MSG_LEN) return;
+    message msg = {.type = MSG_STARTUP};
+    memcpy(msg.data.startup.message, startup_message, sizeof(startup_message));  
+    msg.data.startup.message[sizeof(startup_message)] = data->num_of_workers;
+    msg.data.startup.message[sizeof(startup_message) + 1] = (shm_frame ? FEATURE_SHM_FRAME : 0) | 
+        FEATURE_CODEC_RLE | FEATURE_CODEC_DELTA | FEATURE_FRAMING | FEATURE_CANCEL; // offered
+    msg.data.startup.message[sizeof(startup_message) + 2] = PROTOCOL_VERSION;
+    send_message(&data->module_to_app, msg);
 }
 
-static void send_done_message(int *fd, pthread_mutex_t *fd_lock){
-    message msg = {.type = MSG_DONE};
-    send_message(fd, msg, fd_lock);
+// boss thread clears the queue and stops the workers, MSG_COMPUTE waits until it is done
+static void request_abort(thread_shared_data_t *data){
+    atomic_store(&data->abort, true);
+    event_signal(data->boss_wake);
 }
 
+// queued requests of the chunk are dropped, the worker computing it stops. The app ignores whatever
+// still comes, e.g. when the boss has already taken the chunk but not given it to a worker.
+static void cancel_chunk(thread_shared_data_t *data, uint32_t cid){
+    message chunk = {.data.compute.cid = cid};
+    if (queue_erase(data->queue_of_work, &chunk)) return;
+    for (int i = 0; i < data->num_of_workers; i++){
+        data_compute_worker_t *worker_data = data->workers[i];
+        pthread_mutex_lock(&worker_data->lock);
+        if (atomic_load(&worker_data->is_busy) && worker_data->cid == cid){
+            atomic_store(&worker_data->cancel, true);
+        }
+        pthread_mutex_unlock(&worker_data->lock);
+    }
+}
+
+// waits for the next app on the listening socket, features are negotiated again with every app
+static bool accept_app(thread_shared_data_t *data){
+    int fd = transport_accept(data->listen_fd, &quit);
+    if (fd == -1) return false;
+    atomic_store(&shm_frame_enabled, false);
+    atomic_store(&packed_codecs, 0);
+    atomic_store(&protocol_version, 1);
+    return attach_socket(&data->app_to_module, &data->module_to_app, fd);
+}
+
+static void send_capabilities_message(data_t *out){
+    message msg = {.type = MSG_CAPABILITIES, 
+        .data.capabilities.version = PROTOCOL_VERSION,
+        .data.capabilities.kernels = KERNEL_JULIA,
+        .data.capabilities.max_iterations = UINT8_MAX, // iterations are stored in one byte
+        .data.capabilities.codecs = FEATURE_CODEC_RLE | FEATURE_CODEC_DELTA,
+        .data.capabilities.transports = TRANSPORT_PIPE | TRANSPORT_UNIX | TRANSPORT_TCP | TRANSPORT_SPAWN | 
+            (shm_frame ? TRANSPORT_SHM : 0),
+        .data.capabilities.max_chunk_pixels = MAX_CHUNK_PIXELS};
+    send_message(out, msg);
+}
+
+
 static void print_help(void){
     fprintf(stderr, "\n============================= ARGUMENTS ============================\n");
     fprintf(stderr, "  argv[1] - Number of worker threads. Must be between 1 and 8 (default %d).\n", 
         DEFAULT_NUM_OF_WORKERS);
-    fprintf(stderr, "  argv[2] - App to module named pipe path. Has to be opened beforehand.\n");
-    fprintf(stderr, "  argv[3] - Module to app named pipe path. Has to be opened beforehand.\n");
+    fprintf(stderr, "  argv[2] - App to module named pipe path. Has to be opened beforehand.\n"
+                    "            Or unix:/path or tcp:[host]:port to listen for the app on a socket.\n"
+                    "            Or fd:N when started by the app.\n");
+    fprintf(stderr, "  argv[3] - Module to app named pipe path. Has to be opened beforehand.\n"
+                    "            Not used with sockets.\n");
+    fprintf(stderr, "  argv[4] - File computed chunks are cached in (default %s), '%s' to compute\n"
+                    "            everything.\n", tile_cache_default_path(), TILE_CACHE_DISABLED);
     fprintf(stderr, "============================= COMMANDS =============================\n");
     fprintf(stderr, "  'q' - Quit module.\n"); 
     fprintf(stderr, "  'a' - Abort computation.\n");
@@ -448,6 +679,9 @@ static void computational_module_init(void){
     fprintf(stderr, "INFO: Press 'h' for help.\n");
     signal(SIGPIPE, SIG_IGN);
     atomic_store(&quit, false);
+    atomic_store(&shm_frame_enabled, false);
+    atomic_store(&packed_codecs, 0);
+    atomic_store(&protocol_version, 1);
 }
 
 
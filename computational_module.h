@@ -9,26 +9,39 @@
 #endif
 
 #define DEFAULT_NUM_OF_WORKERS 2
+#define MAX_CHUNK_PIXELS SHM_FRAME_SLOT_CAPACITY // workers keep a chunk on their stack
 
 typedef struct {
     data_t module_to_app;
     data_t app_to_module;
     queue_t *queue_of_work;
     atomic_bool abort;
+    uint8_t num_of_workers;
+    struct data_compute_worker **workers; // MSG_CANCEL stops the one computing the chunk
+    int listen_fd;       // socket transports only, -1 for named pipes
+    const char *channel; // name of the channel given on the command line
+    int channel_ready;   // events: channel opened by main(), stays signalled
+    int boss_wake;       // work queued, abort raised or a worker got free
+    int abort_done;      // boss has aborted the workers and cleared the queue
 } thread_shared_data_t;
 
-typedef struct {
+typedef struct data_compute_worker {
     atomic_bool is_ready; // thread has been created
     atomic_bool abort;
+    atomic_bool cancel;   // the chunk being computed is not needed any more
     atomic_bool is_busy;
     pthread_mutex_t lock;
     pthread_cond_t cond;
     message work;
+    uint32_t cid;         // of the chunk handed to the worker, guarded by lock
     data_t *module_to_app;
+    int boss_wake;
 } data_compute_worker_t;
 
 typedef struct {
     atomic_bool *abort;
+    int wake;
+    int abort_done;
     queue_t *queue_of_work;
     uint8_t num_of_workers;
     data_compute_worker_t **array_of_ptrs_to_worker_data;
@@ -13,14 +13,36 @@ The licence for this library is at the end of "std_image_write.h" file.
 
 static void *read_user_input(void* arg);
 static void *read_from_pipe(void *arg);
+static void *render_frames(void *arg);
 static void cleanup(void);
 static thread_shared_data_t *thread_shared_data_init(void);
 static void destroy_shared_data(thread_shared_data_t *data);
 static void control_app_init(int argc, char *argv[]);
-static void send_compute_message(thread_shared_data_t *data);
-static void send_set_compute_message(thread_shared_data_t *data);
-static void handle_message_compute_data(message msg);
-static void handle_message_compute_data_burst(message msg);
+static void send_compute_message(thread_shared_data_t *data, bool whole_frame);
+static void abort_requests(thread_shared_data_t *data, bool forget_frame);
+static void retarget_requests(module_pool_t *pool, int dx, int dy, bool *adopted);
+static void queue_prefetch(thread_shared_data_t *data, const msg_set_compute *setup, uint8_t *iters);
+static void supersede_requests(thread_shared_data_t *data);
+static void defer_view_request(bool whole_frame);
+static void request_view(thread_shared_data_t *data);
+static void send_set_compute_message(thread_shared_data_t *data, bool keep_work);
+static void handle_message_compute_data(module_t *module, message msg);
+static void handle_message_compute_data_burst(module_t *module, message msg);
+static void handle_message_compute_data_shm(module_t *module, message msg);
+static void handle_message_compute_data_burst_packed(module_t *module, message msg);
+static void store_chunk(module_t *module, uint32_t cid, int length, const uint8_t *iters);
+static void copy_chunk(uint32_t cid, int length, const uint8_t *iters);
+static const palette_t *frame_colours(void);
+static bool render_frame(bool whole, int offset);
+static void mark_chunk_dirty(uint32_t cid);
+static void recolour_frame(void);
+static void advance_ns(struct timespec *time, long ns);
+static void accept_module_features(module_t *module, uint8_t offered, uint8_t version);
+static bool chunks_fit_protocol(module_pool_t *pool);
+static bool open_module_channel(module_t *module);
+static bool spawn_module(module_t *module);
+static bool restart_module(module_t *module);
+static void module_exec_path(char *path, size_t size);
 static void close_window_safe(void);
 static void redraw_window_safe(void);
 static void open_window_safe(void);
@@ -35,52 +57,106 @@ static void set_lower_left_corner(void);
 static void set_upper_right_corner(void);
 static void set_recurzive_constant(void);
 static void calculate_window_parameters(void);
-static void zoom_in(void);
-static void zoom_out(void);
-static void move_image(int direction);
+static bool zoom_in(void);
+static bool zoom_out(void);
+static void snap_view(int level);
+static int snapped_level(void);
+static bool move_image(module_pool_t *pool, int direction);
+static void leave_view(bool moved);
+static void remember_left_view(void);
+static void remember_view(int stack);
+static bool view_fits(int stack);
+static void restore_view(thread_shared_data_t *data, int stack);
+static bool pan_view(int direction, complex double *lower_left, complex double *upper_right, int *dx, int *dy);
+static void shift_frame(module_pool_t *pool, int dx, int dy);
+static void reproject_frame(complex double old_lower_left_corner, complex double old_pixel_size);
 static void save_image(void);
-static void wait_for_key_release_or_delay(int timeout_interval_ms, int max_total_delay_ms);
+static bool wait_for_key_release_or_delay(int timeout_interval_ms, int max_total_delay_ms);
+static int read_key(uint8_t *c);
+static int elapsed_ms(const struct timespec *since, const struct timespec *now);
 
-static uint8_t chunk_width = 64;
-static uint8_t chunk_height = 48;
-static uint8_t chunks_in_row = 4;
-static uint8_t chunks_in_col = 4; 
+static uint16_t chunk_width = 64;
+static uint16_t chunk_height = 48;
+static uint16_t chunks_in_row = 4;
+static uint16_t chunks_in_col = 4; 
 static int width = 0;  // will be calculated at runtime
 static int heigth = 0; 
 static uint8_t *bitmap; 
+static uint8_t *iterations; // computed iteration count of every pixel of the bitmap
 static uint8_t num_of_iterations = 100;
+static palette_t palette; // rebuilt when num_of_iterations changes
+static uint8_t palette_kind = PALETTE_POLYNOMIAL;
+static bool equalize = false;      // colours follow the histogram of the frame instead of the counts
+static histogram_t histogram;      // of the iterations buffer
+static palette_t equalized;        // palette remapped by the histogram
+static pthread_mutex_t colouring_lock = PTHREAD_MUTEX_INITIALIZER; // histogram and equalized palette
+static int render_fps = RENDER_FPS;
+static int render_event = -1;      // wakes the render thread
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER; // what the next frame renders
+static bool dirty_chunks[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+static bool dirty_frame;           // whole bitmap is to be recoloured
+static bool render_pending;        // something is dirty, the render thread waits for the next frame
+static bool chunk_known[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW]; // counts are final for the view, colouring_lock
+static tile_key_t chunk_keys[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW]; // of the last request, colouring_lock
+static tile_key_t prefetch_keys[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW]; // cid - PREFETCH_CID_BASE, colouring_lock
+static int prefetch_dx, prefetch_dy; // shift of the frame the prefetched chunks are for, colouring_lock
+static view_history_t history;     // views left by navigation, keyboard thread only
+static int last_navigation = 0;    // DIRECTION_* of the last pan, 0 if the next view cannot be guessed
+static bool view_pending = false;  // navigation changed the view, it is requested when the key is released
+static bool view_pending_whole = false;
+static bool view_remembered = false; // the view the pending navigation started from is on the back stack
+static bool view_just_remembered = false; // by the key being handled
+static tile_cache_t *tile_cache;   // NULL if chunks are not cached
+static tile_pyramid_t pyramid;     // chunks of snapped views
+static bool snapped = false;       // view is kept on the grid of the pyramid
 static complex double lower_left_corner =  -1.6 - 1.1 * I;
 static complex double upper_right_corner = 1.6 + 1.1 * I;
 static complex double pixel_size = 0.0 + 0.0 * I; // will be calculated at runtime
 static complex double recurzive_eq_constant = -0.4 + 0.6 * I; 
 static int window_state = WINDOW_NOT_INITIATED;
 static queue_t queue_of_CIDs_to_be_computed;
-static uint8_t module_num_of_threads = 1; // set with module startup message
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER; // readers of all modules redraw
+static event_loop_t keyboard_loop; // stdin and quit, used by the keyboard thread only
 
 int main(int argc, char *argv[]) {
     control_app_init(argc, argv);
 
-    int N = 2, ret = ERROR_OK;
+    int N = 1, ret = ERROR_OK;
     thread_shared_data_t *data = thread_shared_data_init();
 
-    thread_t threads[] = {
-        {.thread_name = "Keyboard", .thread_function = read_user_input, .data = data}, 
-        {.thread_name = "Pipe", .thread_function = read_from_pipe, .data = data}
-    };
+    // every module has its channel in the comma separated list, pipes have both lists
+    char default_in[] = "/tmp/computational_module.in", default_out[] = "/tmp/computational_module.out";
+    char *app_to_module_names = argc >= 2 ? argv[1] : default_in; // strtok_r() writes to the lists
+    char *module_to_app_names = argc >= 3 ? argv[2] : default_out;
+    char *in_save = NULL, *out_save = NULL;
+    for (char *name = strtok_r(app_to_module_names, MODULE_CHANNEL_SEPARATOR, &in_save); name != NULL;
+        name = strtok_r(NULL, MODULE_CHANNEL_SEPARATOR, &in_save)){
+        const char *out_name = strtok_r(out_save == NULL ? module_to_app_names : NULL, 
+            MODULE_CHANNEL_SEPARATOR, &out_save);
+        module_t *module = pool_add(&data->pool, name);
+        if (module == NULL) break;
+        module->reply_channel = out_name != NULL ? out_name : default_out;
+    }
 
-    if ((ret = create_all_threads(N, threads)) != ERROR_OK) return ret;    
+    thread_t threads[2 + MAX_MODULES];
+    threads[0] = (thread_t){.thread_name = "Keyboard", .thread_function = read_user_input, .data = data};
+    threads[N++] = (thread_t){.thread_name = "Render", .thread_function = render_frames, .data = data};
+    char thread_names[MAX_MODULES][sizeof("Module 0")];
+    for (int i = 0; i < data->pool.num_of_modules; i++, N++){
+        snprintf(thread_names[i], sizeof(thread_names[i]), "Module %d", i);
+        threads[N] = (thread_t){.thread_name = thread_names[i], .thread_function = read_from_pipe, 
+            .data = &data->pool.modules[i]};
+    }
 
-    const char *app_to_module_pipe_name = argc >= 3 ? argv[1] : "/tmp/computational_module.in";
-    const char *module_to_app_pipe_name = argc >= 3 ? argv[2] : "/tmp/computational_module.out";
-    
-    open_pipes(&data->module_to_app, &data->app_to_module, &data->quit, 
-        module_to_app_pipe_name, app_to_module_pipe_name);
-    
+    if ((ret = create_all_threads(N, threads)) != ERROR_OK) return ret;    
         
     join_all_threads(N, threads);
+    for (int i = 0; i < data->pool.num_of_modules; i++){
+        if (data->pool.modules[i].open_failed) ret = ERROR_OPENING_PIPE;
+    }
     destroy_shared_data(data);
 
-    return ERROR_OK;
+    return ret;
 }
 
 static void *read_user_input(void* arg){
@@ -89,54 +165,58 @@ static void *read_user_input(void* arg){
     int r;
     message msg;
     bool allow_new_keypress = true;  // only allow single presses, not holding down a key
+    if (!event_loop_init(&keyboard_loop) || !event_loop_add(&keyboard_loop, STDIN_FILENO, EVENT_INPUT)){
+        return NULL;
+    }
     while (!data->quit){             // if a key is held down, it is registred as one press 
                                      // every KEY_HELD_REGISTER_PRESS_INTERVAL ms 
-        if ((r = io_getc_timeout(STDIN_FILENO, DELAY_MS, &c)) == -1){
-            fprintf(stderr, "ERROR: io_getc_timeout() from stdin failed: %s\n", strerror(errno));
-            continue;
-        } else if (r == 0 && allow_new_keypress){             
-            continue; // no character read
-        }
         if (!allow_new_keypress) {
-            wait_for_key_release_or_delay(NO_KEY_PRESSED_INTERVAL, KEY_HELD_REGISTER_PRESS_INTERVAL);
+            bool released = wait_for_key_release_or_delay(NO_KEY_PRESSED_INTERVAL, KEY_HELD_REGISTER_PRESS_INTERVAL);
             allow_new_keypress = true;
+            if (released && view_pending) request_view(data); // views passed while it was held are skipped
+            continue;
+        }
+        if ((r = read_key(&c)) == -1){
+            fprintf(stderr, "ERROR: io_getc_timeout() from stdin failed: %s\n", strerror(errno));
             continue;
+        } else if (r == 0){             
+            continue; // no character read
         }
         allow_new_keypress = false;
 
         switch (c)
         {
         case 'q': 
-            if (data->app_to_module.fd != -1){
+            if (pool_connected(&data->pool)){
                 fprintf(stderr, "INFO: Quiting control application.\n");
                 msg.type = MSG_QUIT;
-                send_message(&data->app_to_module.fd, msg, &data->app_to_module.lock);   
+                pool_broadcast(&data->pool, msg);
             }
             fprintf(stderr, "INFO: Quiting module.\n");
-            atomic_store(&data->quit, true);
+            event_raise_quit(&data->quit);
             close_window_safe();          
             break;
         case 'g':
-            if (data->app_to_module.fd == -1) break;
+            if (!pool_connected(&data->pool)) break;
             fprintf(stderr, "INFO: Requesting module version.\n");
             msg.type = MSG_GET_VERSION;
-            send_message(&data->app_to_module.fd, msg, &data->app_to_module.lock);
+            pool_broadcast(&data->pool, msg);
             break;
         case 's':
-            if (data->app_to_module.fd == -1) break;
+            if (!pool_connected(&data->pool)) break;
             fprintf(stderr, "INFO: Setting module computation data.\n");
-            send_set_compute_message(data);
+            send_set_compute_message(data, false);
             break;
         case '1':
-            if (data->app_to_module.fd == -1) break;
-            send_compute_message(data);
+            if (!pool_connected(&data->pool)) break;
+            last_navigation = 0;
+            send_compute_message(data, true);
             break;   
         case 'a':
-            if (data->app_to_module.fd == -1) break;
+            if (!pool_connected(&data->pool)) break;
             fprintf(stderr, "INFO: Requesting abortion.\n");
-            queue_clear(&queue_of_CIDs_to_be_computed);
-            msg.type = MSG_ABORT;
-            send_message(&data->app_to_module.fd, msg, &data->app_to_module.lock); 
+            abort_requests(data, false);
+            pool_send_abort(&data->pool);
             break;
         case 'w':
             open_window_safe();
@@ -147,9 +227,31 @@ static void *read_user_input(void* arg){
         case 'c':
             close_window_safe();
             break;
+        case 'o':
+            palette_kind = (palette_kind + 1) % PALETTE_NBR;
+            fprintf(stderr, "INFO: Colouring with the %s palette.\n", palette_name(palette_kind));
+            palette_update(&palette, palette.num_of_iterations, palette_kind);
+            if (atomic_load(&data->cycling)) break; // next frame of the animation uses it
+            recolour_frame();
+            break;
+        case 'm':
+            equalize = !equalize;
+            fprintf(stderr, "INFO: Colouring by %s.\n", equalize ? "histogram equalization" : "iteration count");
+            if (atomic_load(&data->cycling)) break;
+            recolour_frame();
+            break;
+        case 'y':
+            atomic_store(&data->cycling, !atomic_load(&data->cycling));
+            event_signal(render_event);
+            break;
         case 'e':
             fprintf(stderr, "INFO: Cleared bitmap buffer.\n");
             memset(bitmap, 0x00, width * heigth * 3);
+            pthread_mutex_lock(&colouring_lock);
+            memset(iterations, 0x00, width * heigth);
+            histogram_reset(&histogram, width * heigth);
+            memset(chunk_known, 0, sizeof(chunk_known));
+            pthread_mutex_unlock(&colouring_lock);
             if (window_state == WINDOW_ACTIVE) xwin_redraw(width, heigth, bitmap);
             break;  
         case 'h':
@@ -157,30 +259,67 @@ static void *read_user_input(void* arg){
             break;
         case 'p':
             open_parameters_settings(data);
+            pthread_mutex_lock(&colouring_lock);
+            memset(chunk_known, 0, sizeof(chunk_known)); // a pan must not keep counts of the old parameters
+            pthread_mutex_unlock(&colouring_lock);
             fprintf(stderr, "INFO: Press 's' to send new computation parameters to module.\n");
             break;
         case '+':
             if (window_state != WINDOW_ACTIVE) break;
-            zoom_in();
-            if (data->app_to_module.fd == -1) break;
-            send_set_compute_message(data);
-            send_compute_message(data);
+            supersede_requests(data); // nothing of the old view may land in the resampled frame
+            remember_left_view();
+            leave_view(zoom_in());
+            last_navigation = 0;
+            defer_view_request(true);
             break;
         case '-':
             if (window_state != WINDOW_ACTIVE) break;
-            zoom_out();
-            if (data->app_to_module.fd == -1) break;
-            send_set_compute_message(data);
-            send_compute_message(data);
+            supersede_requests(data);
+            remember_left_view();
+            leave_view(zoom_out());
+            last_navigation = 0;
+            defer_view_request(true);
+            break;
+        case 'n':
+            snapped = !snapped;
+            fprintf(stderr, "INFO: Snapped navigation %s.\n", snapped ? "on" : "off");
+            if (!snapped || window_state != WINDOW_ACTIVE) break;
+            supersede_requests(data);
+            remember_left_view();
+            snap_view(snapped_level());
+            leave_view(true);
+            last_navigation = 0;
+            defer_view_request(true);
             break;
         case 27: // arrow escape sequence
             if (io_getc_timeout(STDIN_FILENO, DELAY_MS, &c) != 1 || c != '[') break;
             if (io_getc_timeout(STDIN_FILENO, DELAY_MS, &c) != 1 || c < 'A' || c > 'D') break;
             if (window_state != WINDOW_ACTIVE) break;
-            move_image(c);
-            if (data->app_to_module.fd == -1) break;
-            send_set_compute_message(data);
-            send_compute_message(data);
+            // chunks still in view move with the frame if modules cancel the others one by one, 
+            // otherwise nothing of the old view may land in the shifted frame
+            if (!pool_cancels_chunks(&data->pool)) supersede_requests(data);
+            remember_left_view();
+            leave_view(move_image(&data->pool, c));
+            pool_dispatch(&data->pool); // cancels chunks scrolled out of view
+            last_navigation = c; // panning on is the likely next step
+            // only the exposed strip, unless some module cannot tell stale data from the new one
+            defer_view_request(!pool_filters_stale(&data->pool));
+            break;
+        case 'b':
+        case 'f':
+            if (window_state != WINDOW_ACTIVE) break;
+            if (history_top(&history, c == 'b' ? HISTORY_BACK : HISTORY_FORWARD) == NULL){
+                fprintf(stderr, "INFO: No view to go %s to.\n", c == 'b' ? "back" : "forward");
+                break;
+            }
+            if (!view_fits(c == 'b' ? HISTORY_BACK : HISTORY_FORWARD)) break;
+            supersede_requests(data);
+            remember_view(c == 'b' ? HISTORY_FORWARD : HISTORY_BACK);
+            restore_view(data, c == 'b' ? HISTORY_BACK : HISTORY_FORWARD);
+            view_remembered = false; // navigation from the restored view remembers it
+            last_navigation = 0;
+            // chunks unfinished when the view was left, unless some module cannot tell stale data
+            defer_view_request(!pool_filters_stale(&data->pool));
             break;
         case 'x':
             save_image();
@@ -189,21 +328,34 @@ static void *read_user_input(void* arg){
             break;
         }
     }
+    event_loop_destroy(&keyboard_loop);
     return NULL;
 }
 
 
 static void *read_from_pipe(void *arg){
-    thread_shared_data_t *data = (thread_shared_data_t *)arg;
+    module_t *module = (module_t *)arg;
+    module_pool_t *pool = module->pool;
     
-    while (data->module_to_app.fd == -1 && !atomic_load(&data->quit)) {
-        usleep(DELAY_MS * 1000); // waiting for pipe to be joined
-    }    
+    if (!open_module_channel(module)){ // every module is connected by its own reader, in parallel
+        module->open_failed = !atomic_load(pool->quit);
+        return NULL;
+    }
 
     message msg;
+    bool hangup_reported = false;
 
-    while(!atomic_load(&data->quit)){
-        if (!recieve_message(data->module_to_app.fd, &msg, DELAY_MS, &data->module_to_app.lock)) continue;
+    while(!atomic_load(pool->quit)){
+        if (!recieve_message(&module->module_to_app, &msg, POOL_STALL_CHECK_MS)) {
+            if (atomic_load(&module->module_to_app.hangup) && !hangup_reported && !atomic_load(pool->quit)){
+                fprintf(stderr, "WARN: Module %d has closed the connection.\n", module->index);
+                pool_module_lost(pool, module);
+                if (module->spawn != NULL && !restart_module(module)) break;
+            }
+            hangup_reported = atomic_load(&module->module_to_app.hangup);
+            pool_reassign_stalled(pool);
+            continue;
+        }
         switch (msg.type)
         {
         case MSG_STARTUP: {
@@ -212,10 +364,22 @@ static void *read_from_pipe(void *arg){
             memcpy(startup_message, msg.data.startup.message, STARTUP_MSG_LEN);
             fprintf(stderr, "INFO: Modul startup was successfull. Startup message: %s\n", startup_message);
             while (*(ch++) != '\0') ;
-            module_num_of_threads = *ch;    
-            fprintf(stderr, "INFO: Module is computing on %u threads.\n", module_num_of_threads);
+            fprintf(stderr, "INFO: Module %d is computing on %u threads.\n", module->index, *ch);
+            accept_module_features(module, ch + 1 < startup_message + STARTUP_MSG_LEN ? ch[1] : 0,
+                ch + 2 < startup_message + STARTUP_MSG_LEN ? ch[2] : 0);
+            pool_module_ready(pool, module, *ch, module->protocol_version);
             break;
         }
+        case MSG_CAPABILITIES:
+            pthread_mutex_lock(&pool->lock);
+            module->max_chunk_pixels = msg.data.capabilities.max_chunk_pixels;
+            pthread_mutex_unlock(&pool->lock);
+            fprintf(stderr, "INFO: Module speaks protocol v%d, kernels 0x%02x, at most %d iterations, codecs 0x%02x, "
+                "transports 0x%02x, chunks up to %u pixels.\n", msg.data.capabilities.version, 
+                msg.data.capabilities.kernels, msg.data.capabilities.max_iterations, msg.data.capabilities.codecs,
+                msg.data.capabilities.transports, msg.data.capabilities.max_chunk_pixels);
+            pool_dispatch(pool); // chunks too large for a v1 module may be waiting
+            break;
         case MSG_OK:
             fprintf(stderr, "INFO: Modul responded OK.\n");
             break;
@@ -223,7 +387,7 @@ static void *read_from_pipe(void *arg){
             fprintf(stderr, "WARN: Modul responded ERROR.\n");
             break;
         case MSG_COMPUTE_DATA:
-            handle_message_compute_data(msg);
+            handle_message_compute_data(module, msg);
 #if DEBUG_COMPUTATIONS            
             fprintf(stderr, "DEBUG: Modul returned computed data.\n");
             fprintf(stderr, "DEBUG: cid = %d, i_re = %d, i_im = %d, iter = %d.\n",
@@ -232,27 +396,31 @@ static void *read_from_pipe(void *arg){
 #endif            
             break;
             case MSG_COMPUTE_DATA_BURST:
-            handle_message_compute_data_burst(msg);
+            handle_message_compute_data_burst(module, msg);
 #if DEBUG_COMPUTATIONS
             fprintf(stderr, "DEBUG: Modul returned computed data in burst for "
-                "chunk %d.\n", msg.data.compute_data_burst.chunk_id);
+                "chunk %u.\n", msg.data.compute_data_burst.chunk_id);
 #endif
             break;
+        case MSG_COMPUTE_DATA_BURST_V2:
+            handle_message_compute_data_burst(module, msg);
+            break;
+        case MSG_COMPUTE_DATA_SHM:
+            handle_message_compute_data_shm(module, msg);
+            break;
+        case MSG_COMPUTE_DATA_BURST_PACKED:
+            handle_message_compute_data_burst_packed(module, msg);
+            break;
         case MSG_DONE:
             fprintf(stderr, "INFO: Modul is done with computing a chunk.\n");
-            if (data->app_to_module.fd == -1) break;
-            message *tmp = queue_pop(&queue_of_CIDs_to_be_computed);
-            if (tmp != NULL) {
-#if DEBUG_MULTITHREADING
-                fprintf(stderr, "DEBUG: Requesting computation of chunk %d.\n", tmp->data.compute.cid);
-#endif 
-                send_message(&data->app_to_module.fd, *tmp, &data->app_to_module.lock);
-                free(tmp);
-            }
+            pool_chunk_done(pool, module);
+            if (equalize && pool_idle(pool)) recolour_frame(); // chunks came coloured by a partial histogram
             break;
         case MSG_ABORT:
             fprintf(stderr, "INFO: Modul has aborted computation.\n");
+            if (pool_abort_answered(pool, module)) break; // chunks requested since then are computed
             queue_clear(&queue_of_CIDs_to_be_computed);
+            pool_abort(pool);
             break;
         case MSG_VERSION:
             fprintf(stderr, "INFO: Modul version is %d.%d.%d\n", msg.data.version.major,
@@ -266,6 +434,135 @@ static void *read_from_pipe(void *arg){
     return NULL; 
 } 
 
+// colours and presents what the readers stored, at most render_fps times a second however fast 
+// the chunks come. While the palette cycles, every frame recolours the whole bitmap with the palette
+// rotated by one more count. Frames that cannot be drawn in time are skipped rather than drawn late.
+static void *render_frames(void *arg){
+    thread_shared_data_t *data = (thread_shared_data_t *)arg;
+    const long frame_ns = 1000000000L / render_fps;
+    event_loop_t loop;
+    struct timespec cycling_since, next_frame, now;
+    bool cycling = false;
+    unsigned cycled_frames = 0;
+    int offset = 0;
+    if (!event_loop_init(&loop) || !event_loop_add(&loop, render_event, EVENT_WAKE)) return NULL;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+
+    while (!atomic_load(&data->quit)){
+        pthread_mutex_lock(&render_lock);
+        bool pending = render_pending;
+        pthread_mutex_unlock(&render_lock);
+        int timeout = -1;
+        if (cycling || pending){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout = elapsed_ms(&now, &next_frame) + 1; // rounded up, never wakes before the frame
+            if (timeout < 0) timeout = 0;
+        }
+        uint32_t events = event_loop_wait(&loop, timeout);
+        if (events & EVENT_QUIT) break;
+        if (events & EVENT_WAKE) event_clear(render_event);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (atomic_load(&data->cycling) != cycling){
+            cycling = !cycling;
+            if (cycling){
+                fprintf(stderr, "INFO: Cycling the palette at %d frames per second.\n", render_fps);
+                cycling_since = now;
+                cycled_frames = 0;
+            } else {
+                int ms = elapsed_ms(&cycling_since, &now);
+                fprintf(stderr, "INFO: Palette cycling stopped, %u frames in %d ms (%.1f fps).\n", cycled_frames, 
+                    ms, ms > 0 ? cycled_frames * 1000.0 / ms : 0.0);
+                offset = 0;
+                recolour_frame(); // unrotated colours back
+            }
+        }
+        if (elapsed_ms(&next_frame, &now) < 0) continue; // woken by a chunk before the frame is due
+        if (cycling){
+            offset = palette.num_of_iterations > 0 ? (offset + 1) % palette.num_of_iterations : 0;
+            cycled_frames++;
+        }
+        if (!render_frame(cycling, offset)) continue;
+        advance_ns(&next_frame, frame_ns);
+        if (elapsed_ms(&next_frame, &now) >= 0){ // fell behind or has been idle
+            next_frame = now;
+            advance_ns(&next_frame, frame_ns);
+        }
+    }
+    event_loop_destroy(&loop);
+    return NULL;
+}
+
+// colours the chunks stored since the last frame (the whole bitmap if requested or cycling) and
+// presents them, neighbouring chunks of a row go to the window as one rectangle. Returns false if
+// there was nothing to render.
+static bool render_frame(bool whole, int offset){
+    static xwin_rect_t rects[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW]; // render thread only
+    int n = 0;
+    pthread_mutex_lock(&render_lock);
+    whole = whole || dirty_frame;
+    for (int cid = 0; cid < chunks_in_row * chunks_in_col; cid++){
+        if (!dirty_chunks[cid]) continue;
+        dirty_chunks[cid] = false;
+        int x = (cid % chunks_in_row) * chunk_width;
+        int y = (cid / chunks_in_row) * chunk_height;
+        if (n > 0 && rects[n - 1].y == y && rects[n - 1].x + rects[n - 1].w == x){
+            rects[n - 1].w += chunk_width;
+        } else {
+            rects[n++] = (xwin_rect_t){.x = x, .y = y, .w = chunk_width, .h = chunk_height};
+        }
+    }
+    dirty_frame = render_pending = false;
+    pthread_mutex_unlock(&render_lock);
+    if (whole){
+        rects[0] = (xwin_rect_t){.x = 0, .y = 0, .w = width, .h = heigth};
+        n = 1;
+    }
+    if (n == 0) return false;
+
+    palette_t colours;
+    pthread_mutex_lock(&colouring_lock);
+    palette_rotate(&colours, frame_colours(), offset);
+    pthread_mutex_unlock(&colouring_lock);
+    for (int i = 0; i < n; i++){
+        for (int row = rects[i].y; row < rects[i].y + rects[i].h; row++){
+            int pixel = row * width + rects[i].x;
+            palette_colour_row(&colours, &iterations[pixel], rects[i].w, &bitmap[pixel * 3]);
+        }
+    }
+    if (window_state == WINDOW_ACTIVE){
+        pthread_mutex_lock(&window_lock);
+        xwin_redraw_rects(width, heigth, bitmap, rects, n);
+        pthread_mutex_unlock(&window_lock);
+    }
+    return true;
+}
+
+// the chunk is coloured and presented with the next frame
+static void mark_chunk_dirty(uint32_t cid){
+    pthread_mutex_lock(&render_lock);
+    dirty_chunks[cid] = true;
+    bool wake = !render_pending; // render thread already waits for the frame otherwise
+    render_pending = true;
+    pthread_mutex_unlock(&render_lock);
+    if (wake) event_signal(render_event);
+}
+
+// whole bitmap is coloured again from the stored counts with the next frame
+static void recolour_frame(void){
+    pthread_mutex_lock(&render_lock);
+    dirty_frame = render_pending = true;
+    pthread_mutex_unlock(&render_lock);
+    event_signal(render_event);
+}
+
+static void advance_ns(struct timespec *time, long ns){
+    time->tv_nsec += ns;
+    while (time->tv_nsec >= 1000000000L){
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000L;
+    }
+}
+
 static thread_shared_data_t *thread_shared_data_init(void){
     thread_shared_data_t *data = malloc(sizeof(thread_shared_data_t));
     if (data == NULL){
@@ -273,23 +570,79 @@ static thread_shared_data_t *thread_shared_data_init(void){
         exit(ERROR_ALLOCATION);
     }
     atomic_store(&data->quit, false);
-    data->app_to_module.fd = -1;
-    data->module_to_app.fd = -1;
-    pthread_mutex_init(&data->app_to_module.lock, NULL);
-    pthread_mutex_init(&data->module_to_app.lock, NULL);
+    pool_init(&data->pool, &queue_of_CIDs_to_be_computed, &data->quit);
+    atomic_store(&data->cycling, false);
+    render_event = event_create();
     return data;
 }
 
 static void destroy_shared_data(thread_shared_data_t *data){
-    pthread_mutex_destroy(&data->app_to_module.lock);
-    pthread_mutex_destroy(&data->module_to_app.lock);
+    pool_destroy(&data->pool);
+    event_close(render_event);
     free(data);
 }
 
+// named pipes are opened in order of the modules, sockets connect to the listening module
+static bool open_module_channel(module_t *module){
+    if (transport_kind(module->channel) == TRANSPORT_KIND_SPAWN){
+        module->spawn = module->channel;
+        return spawn_module(module);
+    }
+    if (transport_kind(module->channel) == TRANSPORT_KIND_PIPE){
+        const char *app_to_module_name = module->channel;
+        module->channel = module->reply_channel; // the module names its shared frame after this pipe
+        return open_pipes(&module->module_to_app, &module->app_to_module, module->pool->quit, 
+            module->reply_channel, app_to_module_name);
+    }
+    int fd = transport_connect(module->channel, module->pool->quit);
+    return fd != -1 && attach_socket(&module->module_to_app, &module->app_to_module, fd);
+}
+
+// starts the module over a socketpair, it sends its startup message right away
+static bool spawn_module(module_t *module){
+    char path[PATH_MAX];
+    int fd;
+    module_exec_path(path, sizeof(path));
+    if ((module->pid = transport_spawn(module->spawn, path, &fd)) == -1) return false;
+    transport_spawn_name(module->pid, module->spawned_name, sizeof(module->spawned_name));
+    module->channel = module->spawned_name; // the module names its shared frame after its pid
+    return attach_socket(&module->module_to_app, &module->app_to_module, fd);
+}
+
+// spawned module has exited or crashed, its chunks are with the other modules already
+static bool restart_module(module_t *module){
+    close_channel(&module->module_to_app, &module->app_to_module);
+    if (!transport_reap(module->pid, TRANSPORT_REAP_TIMEOUT_MS)) shm_frame_remove(module->spawned_name);
+    module->pid = -1;
+    if (module->restarts >= MODULE_MAX_RESTARTS){
+        fprintf(stderr, "ERROR: Module %d has been restarted %d times, giving up.\n", module->index, 
+            module->restarts);
+        return false;
+    }
+    module->restarts++;
+    fprintf(stderr, "INFO: Restarting module %d.\n", module->index);
+    return spawn_module(module);
+}
+
+static void module_exec_path(char *path, size_t size){
+    ssize_t len = readlink("/proc/self/exe", path, size - 1);
+    char *slash;
+    if (len <= 0 || (path[len] = '\0', slash = strrchr(path, '/')) == NULL || 
+        (size_t)(slash + 1 - path) + sizeof(MODULE_EXEC_NAME) > size){
+        snprintf(path, size, "./%s", MODULE_EXEC_NAME);
+        return;
+    }
+    strcpy(slash + 1, MODULE_EXEC_NAME);
+}
+
 static void cleanup(void){
     call_termios(SET_TERMINAL_TO_DEFAULT);
     free(bitmap);
+    free(iterations);
     queue_clear(&queue_of_CIDs_to_be_computed);
+    tile_cache_close(tile_cache);
+    pyramid_destroy(&pyramid);
+    history_destroy(&history);
 }
 
 static void control_app_init(int argc, char *argv[]){
@@ -303,13 +656,13 @@ static void control_app_init(int argc, char *argv[]){
     double tmp_dbl;
     if (argc >= 4){ // sets width, rounds down to whole chunks
         tmp = atoi(argv[3]);
-        if (tmp > 0 || tmp <= 16 * chunk_width){
+        if (tmp >= chunk_width && tmp <= MAX_CHUNKS_IN_ROW * chunk_width){
             chunks_in_row = tmp / chunk_width; 
         }
     }
     if (argc >= 5){ // sets heigth, rounds down to whole chunks
         tmp = atoi(argv[4]);
-        if (tmp > 0 || tmp <= 16 * chunk_height){
+        if (tmp >= chunk_height && tmp <= MAX_CHUNKS_IN_ROW * chunk_height){
             chunks_in_col = tmp / chunk_height; 
         }
     }
@@ -356,6 +709,16 @@ static void control_app_init(int argc, char *argv[]){
             num_of_iterations = tmp;
         }
     }
+    if (argc >= 13){ // sets display refresh rate
+        tmp = atoi(argv[12]);
+        if (tmp > 0 && tmp <= MAX_RENDER_FPS){
+            render_fps = tmp;
+        }
+    }
+    tile_cache = tile_cache_open(argc >= 14 ? argv[13] : tile_cache_default_path());
+    pyramid_init(&pyramid);
+    history_init(&history);
+    palette_update(&palette, num_of_iterations, palette_kind);
     calculate_window_parameters();
 }
 
@@ -373,21 +736,47 @@ static void calculate_window_parameters(void){
         ((cimag(upper_right_corner) - cimag(lower_left_corner)) / heigth) * I;
     if (realocate_bitmap){
         free(bitmap);
+        free(iterations);
         bitmap = calloc(width * heigth * 3, sizeof(uint8_t));
+        iterations = calloc(width * heigth, sizeof(uint8_t));
+        histogram_reset(&histogram, width * heigth);
+        memset(chunk_known, 0, sizeof(chunk_known));
 #if DEBUG_MEMORY
         fprintf(stderr, "INFO: Reallocated bitmap buffer. New width = %d, new height = %d, " 
             "new size is %d.\n", width, heigth, width * heigth * 3);
 #endif        
-        if (bitmap == NULL){
+        if (bitmap == NULL || iterations == NULL){
             fprintf(stderr, "FATAL ERROR: Allocation of bitmap failed.\n");
             exit(ERROR_ALLOCATION);
         }
     }
 }
 
-static void send_compute_message(thread_shared_data_t *data){
+// requests the chunks whose counts are neither known for the current view nor cached, all of them
+// for the whole frame
+static void send_compute_message(thread_shared_data_t *data, bool whole_frame){
+    if (!chunks_fit_protocol(&data->pool)) return;
     fprintf(stderr, "INFO: Requesting module computation.\n");
-    queue_clear(&queue_of_CIDs_to_be_computed);
+    bool adopted[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW] = {false}; // requested before, still computed
+    if (whole_frame || !pool_cancels_chunks(&data->pool)){
+        abort_requests(data, whole_frame); // modules drop unfinished chunks with the new computation data
+    } else {
+        pthread_mutex_lock(&colouring_lock);
+        retarget_requests(&data->pool, 0, 0, adopted);
+        pthread_mutex_unlock(&colouring_lock);
+    }
+    bool known[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    pthread_mutex_lock(&colouring_lock);
+    memcpy(known, chunk_known, sizeof(known));
+    pthread_mutex_unlock(&colouring_lock);
+    pthread_mutex_lock(&data->pool.lock);
+    msg_set_compute setup = data->pool.compute_setup.data.set_compute; // what the modules compute with
+    int pixels = chunk_width * chunk_height; // each cache checks the size it keeps itself
+    bool cached = data->pool.has_compute_setup && 
+        (pixels <= TILE_CACHE_SLOT_BYTES || pixels <= PYRAMID_MAX_TILE_BYTES);
+    pthread_mutex_unlock(&data->pool.lock);
+    uint8_t iters[cached ? pixels : 1];
+    int num_of_cached = 0;
     complex double first_chunk_corner = lower_left_corner + 
         ((chunks_in_col - 1) * chunk_height * cimag(pixel_size)) * I;
 #if DEBUG_MULTITHREADING
@@ -396,35 +785,158 @@ static void send_compute_message(thread_shared_data_t *data){
 
     for (int c_row = 0; c_row < chunks_in_col; c_row++){
         for (int c_col = 0; c_col < chunks_in_row; c_col++){
+            if (known[c_row * chunks_in_row + c_col] || adopted[c_row * chunks_in_row + c_col]) continue;
             message *msg;
             if ((msg = malloc(sizeof(message))) == NULL){
                 fprintf(stderr, "ERROR: Allocation of message to request the computation of chunk %d failed.\n",
                     c_row * chunks_in_row + c_col);
                     continue;
             }
-            msg->type = MSG_COMPUTE;
+            msg->type = MSG_COMPUTE_V2; // pool picks the format the chosen module understands
             msg->data.compute.cid = c_row * chunks_in_row + c_col;
             msg->data.compute.re = creal(first_chunk_corner) + c_col * chunk_width * creal(pixel_size);
             msg->data.compute.im = cimag(first_chunk_corner) - c_row * chunk_height * cimag(pixel_size);
             msg->data.compute.n_re = chunk_width;
             msg->data.compute.n_im = chunk_height;
+            tile_key_t key;
+            tile_key_init(&key, &setup, &msg->data.compute);
+            if (cached && (pyramid_lookup(&pyramid, &key, iters) || 
+                tile_cache_lookup(tile_cache, &key, iters, chunk_width * chunk_height))){
+                pyramid_store(&pyramid, &key, iters);
+                pthread_mutex_lock(&colouring_lock);
+                copy_chunk(msg->data.compute.cid, chunk_width * chunk_height, iters);
+                pthread_mutex_unlock(&colouring_lock);
+                mark_chunk_dirty(msg->data.compute.cid);
+                num_of_cached++;
+                free(msg);
+                continue;
+            }
+            pthread_mutex_lock(&colouring_lock);
+            chunk_keys[msg->data.compute.cid] = key; // before any module can be given the chunk
+            pthread_mutex_unlock(&colouring_lock);
             queue_push(&queue_of_CIDs_to_be_computed, msg);
         }
     }
-    usleep(DELAY_MS * 1000);
-    for (int i = 0; i < module_num_of_threads; i++){
-        message *tmp = queue_pop(&queue_of_CIDs_to_be_computed);
-        if (tmp != NULL) {
-#if DEBUG_MULTITHREADING
-            fprintf(stderr, "DEBUG: Requesting computation of chunk %d.\n", tmp->data.compute.cid);
-#endif            
-            send_message(&data->app_to_module.fd, *tmp, &data->app_to_module.lock);
-            free(tmp);
+    if (num_of_cached > 0){
+        fprintf(stderr, "INFO: %d chunks were found in the tile cache.\n", num_of_cached);
+        if (equalize && pool_idle(&data->pool)) recolour_frame(); // nothing comes to finish the frame
+    }
+    if (cached) queue_prefetch(data, &setup, iters);
+    pool_dispatch(&data->pool);
+}
+
+// chunks the next pan in the same direction would request are queued behind the ones of the current
+// view, so modules compute them into the caches once they have nothing else to do. The next request
+// aborts them with everything else. Zooms are not guessed, their chunks need another pixel size.
+static void queue_prefetch(thread_shared_data_t *data, const msg_set_compute *setup, uint8_t *iters){
+    complex double next_lower_left = lower_left_corner, next_upper_right = upper_right_corner;
+    int dx, dy, num_of_prefetched = 0;
+    if (last_navigation == 0 || !pool_filters_stale(&data->pool) || 
+        !pan_view(last_navigation, &next_lower_left, &next_upper_right, &dx, &dy)) return;
+    complex double first_chunk_corner = next_lower_left + 
+        ((chunks_in_col - 1) * chunk_height * cimag(pixel_size)) * I;
+    for (int c_row = 0; c_row < chunks_in_col; c_row++){
+        for (int c_col = 0; c_col < chunks_in_row; c_col++){
+            int x0 = c_col * chunk_width + dx, y0 = c_row * chunk_height + dy; // as shift_frame() sees it
+            if (x0 >= 0 && y0 >= 0 && x0 + chunk_width <= width && y0 + chunk_height <= heigth) continue;
+            msg_compute chunk = {.cid = PREFETCH_CID_BASE + c_row * chunks_in_row + c_col,
+                .re = creal(first_chunk_corner) + c_col * chunk_width * creal(pixel_size),
+                .im = cimag(first_chunk_corner) - c_row * chunk_height * cimag(pixel_size),
+                .n_re = chunk_width, .n_im = chunk_height};
+            tile_key_t key;
+            tile_key_init(&key, setup, &chunk);
+            if ((tile_cache == NULL && !pyramid_on_grid(&key)) || pyramid_lookup(&pyramid, &key, iters) ||
+                tile_cache_lookup(tile_cache, &key, iters, chunk_width * chunk_height)) continue;
+            message *msg = malloc(sizeof(message));
+            if (msg == NULL){
+                fprintf(stderr, "ERROR: Allocation of message to prefetch chunk %d failed.\n", chunk.cid);
+                continue;
+            }
+            msg->type = MSG_COMPUTE_V2;
+            msg->data.compute = chunk;
+            pthread_mutex_lock(&colouring_lock);
+            prefetch_keys[chunk.cid - PREFETCH_CID_BASE] = key;
+            prefetch_dx = dx;
+            prefetch_dy = dy;
+            pthread_mutex_unlock(&colouring_lock);
+            queue_push(&queue_of_CIDs_to_be_computed, msg);
+            num_of_prefetched++;
+        }
+    }
+    if (num_of_prefetched > 0){
+        fprintf(stderr, "INFO: Prefetching %d chunks of the next pan.\n", num_of_prefetched);
+    }
+}
+
+// chunks requested so far are dropped when they come, so is the whole frame if it is to be forgotten
+static void abort_requests(thread_shared_data_t *data, bool forget_frame){
+    pthread_mutex_lock(&colouring_lock); // no reader is storing a chunk it has already accepted
+    queue_clear(&queue_of_CIDs_to_be_computed);
+    pool_abort(&data->pool);
+    if (forget_frame) memset(chunk_known, 0, sizeof(chunk_known));
+    pthread_mutex_unlock(&colouring_lock);
+}
+
+// chunks requested so far that the frame shifted by (dx, dy) still has are computed on under their
+// new cids, so are the prefetched ones if the shift is the predicted one. The others are cancelled.
+// The caller holds colouring_lock, no chunk lands in the frame between the shift and the new cids.
+static void retarget_requests(module_pool_t *pool, int dx, int dy, bool *adopted){
+    static int32_t targets[PREFETCH_CID_BASE + MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    static int32_t sources[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    static tile_key_t keys[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    int num_of_chunks = chunks_in_row * chunks_in_col;
+    bool aligned = dx % chunk_width == 0 && dy % chunk_height == 0; // chunks of the old view are on the grid
+    bool predicted = (dx != 0 || dy != 0) && dx == prefetch_dx && dy == prefetch_dy;
+    for (int cid = 0; cid < PREFETCH_CID_BASE + num_of_chunks; cid++) targets[cid] = -1;
+    for (int cid = 0; cid < num_of_chunks; cid++) sources[cid] = -1;
+    for (int c_row = 0; aligned && c_row < chunks_in_col; c_row++){
+        for (int c_col = 0; c_col < chunks_in_row; c_col++){
+            int row = c_row - dy / chunk_height, col = c_col - dx / chunk_width; // as shift_frame() moves it
+            if (row < 0 || col < 0 || row >= chunks_in_col || col >= chunks_in_row) continue; // out of view
+            targets[c_row * chunks_in_row + c_col] = row * chunks_in_row + col;
+            sources[row * chunks_in_row + col] = c_row * chunks_in_row + c_col;
         }
     }
+    for (int cid = 0; predicted && cid < num_of_chunks; cid++){
+        if (sources[cid] != -1) continue;
+        targets[PREFETCH_CID_BASE + cid] = cid;
+        sources[cid] = PREFETCH_CID_BASE + cid;
+    }
+    pool_retarget(pool, targets, PREFETCH_CID_BASE + num_of_chunks, adopted);
+    for (int cid = 0; cid < num_of_chunks; cid++){ // keys go with the chunks for the caches
+        if (!adopted[cid]) continue;
+        keys[cid] = sources[cid] < PREFETCH_CID_BASE ? chunk_keys[sources[cid]] : 
+            prefetch_keys[sources[cid] - PREFETCH_CID_BASE];
+    }
+    for (int cid = 0; cid < num_of_chunks; cid++){
+        if (adopted[cid]) chunk_keys[cid] = keys[cid];
+    }
 }
 
-static void send_set_compute_message(thread_shared_data_t *data){
+// work for the view left by navigation is of no use, modules stop it now instead of when the next
+// view is requested
+static void supersede_requests(thread_shared_data_t *data){
+    bool busy = !pool_idle(&data->pool);
+    abort_requests(data, false);
+    if (busy) pool_send_abort(&data->pool);
+}
+
+// a held key passes many views, only the one it stops at is computed
+static void defer_view_request(bool whole_frame){
+    view_pending = true;
+    view_pending_whole |= whole_frame;
+}
+
+static void request_view(thread_shared_data_t *data){
+    bool whole_frame = view_pending_whole;
+    view_pending = view_pending_whole = view_remembered = false;
+    if (!pool_connected(&data->pool)) return;
+    send_set_compute_message(data, !whole_frame);
+    send_compute_message(data, whole_frame);
+}
+
+// modules drop all their work with MSG_SET_COMPUTE, so it is not sent to keep the chunks of a pan
+static void send_set_compute_message(thread_shared_data_t *data, bool keep_work){
     message msg;
     msg.type = MSG_SET_COMPUTE;
     msg.data.set_compute.c_re = creal(recurzive_eq_constant);
@@ -432,53 +944,167 @@ static void send_set_compute_message(thread_shared_data_t *data){
     msg.data.set_compute.d_re = creal(pixel_size);
     msg.data.set_compute.d_im = cimag(pixel_size);
     msg.data.set_compute.n = num_of_iterations;
-    send_message(&data->app_to_module.fd, msg, &data->app_to_module.lock);
+    palette_update(&palette, num_of_iterations, palette_kind); // before any chunk of the new setting arrives
+    pthread_mutex_lock(&data->pool.lock);
+    msg_set_compute *last = &data->pool.compute_setup.data.set_compute;
+    bool unchanged = data->pool.has_compute_setup && last->c_re == msg.data.set_compute.c_re && 
+        last->c_im == msg.data.set_compute.c_im && last->d_re == msg.data.set_compute.d_re && 
+        last->d_im == msg.data.set_compute.d_im && last->n == msg.data.set_compute.n;
+    pthread_mutex_unlock(&data->pool.lock);
+    if (keep_work && unchanged) return;
+    pool_set_compute(&data->pool, msg);
 }
 
-static void handle_message_compute_data(message msg){
-    int chunk_row = msg.data.compute_data.cid / chunks_in_row;
-    int chunk_col = msg.data.compute_data.cid % chunks_in_row;
+static void handle_message_compute_data(module_t *module, message msg){
+    uint32_t cid = msg.data.compute_data.cid;
+    pthread_mutex_lock(&colouring_lock);
+    if (!pool_chunk_received(module->pool, module, &cid) || cid >= (uint32_t)chunks_in_row * chunks_in_col){
+        pthread_mutex_unlock(&colouring_lock);
+        return;
+    }
+    int chunk_row = cid / chunks_in_row;
+    int chunk_col = cid % chunks_in_row;
 
     int row = chunk_row * chunk_height + (chunk_height - 1) - msg.data.compute_data.i_im;
     int col = chunk_col * chunk_width + msg.data.compute_data.i_re;
-    int idx = (row * width + col) * 3;
-    double t = (double)msg.data.compute_data.iter / num_of_iterations;
-    uint8_t red = (uint8_t) 9 * (1 - t) * t * t * t * 255;
-    uint8_t green = (uint8_t) 15 * (1 - t) * (1 - t) * t * t * 255;
-    uint8_t blue = (uint8_t) 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
-    bitmap[idx] = red;
-    bitmap[idx + 1] = green;
-    bitmap[idx + 2] = blue;
-}
-
-static void handle_message_compute_data_burst(message msg){
-    int chunk_row = msg.data.compute_data.cid / chunks_in_row;
-    int chunk_col = msg.data.compute_data.cid % chunks_in_row;
+    histogram_replace(&histogram, &iterations[row * width + col], &msg.data.compute_data.iter, 1);
+    iterations[row * width + col] = msg.data.compute_data.iter;
+    pthread_mutex_unlock(&colouring_lock);
+    mark_chunk_dirty(cid);
+}
+
+static void handle_message_compute_data_burst(module_t *module, message msg){
+    store_chunk(module, msg.data.compute_data_burst.chunk_id, msg.data.compute_data_burst.length, 
+        msg.data.compute_data_burst.iters);
+    free(msg.data.compute_data_burst.iters);
+}
+
+static void handle_message_compute_data_shm(module_t *module, message msg){
+    const uint8_t *iters = shm_frame_slot(module->shm_frame, msg.data.compute_data_shm.slot);
+    if (iters == NULL){
+        fprintf(stderr, "WARN: Module sent shared frame slot %d, but no shared frame is attached.\n",
+            msg.data.compute_data_shm.slot);
+        pool_chunk_received(module->pool, module, &msg.data.compute_data_shm.chunk_id);
+        return;
+    }
+    store_chunk(module, msg.data.compute_data_shm.chunk_id, msg.data.compute_data_shm.length, iters);
+    shm_frame_release(module->shm_frame, msg.data.compute_data_shm.slot); // module may reuse the slot
+}
+
+static void handle_message_compute_data_burst_packed(module_t *module, message msg){
+    msg_compute_data_burst_packed *packed = &msg.data.compute_data_burst_packed;
+    if (packed->length > (uint32_t)chunk_width * chunk_height){
+        fprintf(stderr, "WARN: Compressed chunk %u of %u pixels does not fit the image.\n", packed->chunk_id,
+            packed->length);
+        pool_chunk_received(module->pool, module, &packed->chunk_id);
+        free(packed->data);
+        return;
+    }
+    uint8_t iters[packed->length > 0 ? packed->length : 1];
+    if (codec_decode(packed->codec, packed->data, packed->packed_length, iters, packed->length)){
+        store_chunk(module, packed->chunk_id, packed->length, iters);
+    } else {
+        fprintf(stderr, "WARN: Decoding chunk %u compressed by codec %d failed.\n", packed->chunk_id, 
+            packed->codec);
+        pool_chunk_received(module->pool, module, &packed->chunk_id);
+    }
+    free(packed->data);
+}
+
+// readers only store the counts, the render thread colours them with the next frame. Chunks of
+// an aborted request are dropped, a frame shifted meanwhile must not get the data of the old view.
+static void store_chunk(module_t *module, uint32_t cid, int length, const uint8_t *iters){
+    pthread_mutex_lock(&colouring_lock); // abort_requests() cannot come between the check and the store
+    if (!pool_chunk_received(module->pool, module, &cid)){
+        pthread_mutex_unlock(&colouring_lock);
+        return;
+    }
+    if (cid >= PREFETCH_CID_BASE && cid < PREFETCH_CID_BASE + (uint32_t)chunks_in_row * chunks_in_col && 
+        length == chunk_width * chunk_height){ // not part of the frame yet
+        tile_key_t key = prefetch_keys[cid - PREFETCH_CID_BASE];
+        pthread_mutex_unlock(&colouring_lock);
+        pyramid_store(&pyramid, &key, iters);
+        tile_cache_store(tile_cache, &key, iters, length);
+        return;
+    }
+    if (cid >= (uint32_t)chunks_in_row * chunks_in_col || length > chunk_width * chunk_height){
+        pthread_mutex_unlock(&colouring_lock);
+        fprintf(stderr, "WARN: Module sent chunk %u of %d pixels that does not fit the image.\n", cid, length);
+        return;
+    }
+    copy_chunk(cid, length, iters);
+    // chunks of v1 modules cannot be told from the ones requested before the last abort
+    bool cache_it = length == chunk_width * chunk_height && module->protocol_version >= 2;
+    tile_key_t key = chunk_keys[cid];
+    pthread_mutex_unlock(&colouring_lock);
+    mark_chunk_dirty(cid);
+    if (cache_it){
+        pyramid_store(&pyramid, &key, iters);
+        tile_cache_store(tile_cache, &key, iters, length);
+    }
+}
+
+// counts of a chunk to the iterations buffer, the caller holds colouring_lock
+static void copy_chunk(uint32_t cid, int length, const uint8_t *iters){
+    int chunk_row = cid / chunks_in_row;
+    int chunk_col = cid % chunks_in_row;
     int lower_left_corner_row = (chunk_row + 1) * chunk_height - 1;
     int lower_left_corner_col = chunk_col * chunk_width;
-    int row, col, idx;
-    double t;
-    uint8_t red, green, blue;
-    for (int i = 0; i < msg.data.compute_data_burst.length; i++){
-        row = lower_left_corner_row - i / chunk_width;
-        col = lower_left_corner_col + i % chunk_width;
-        idx = (row * width + col) * 3;
-        t = (double)msg.data.compute_data_burst.iters[i] / num_of_iterations;
-        red = (uint8_t) 9 * (1 - t) * t * t * t * 255;
-        green = (uint8_t) 15 * (1 - t) * (1 - t) * t * t * 255;
-        blue = (uint8_t) 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
+    for (int i = 0; i < length; i += chunk_width){ // chunk rows are sent from the bottom up
+        int pixel = (lower_left_corner_row - i / chunk_width) * width + lower_left_corner_col;
+        int row_length = length - i < chunk_width ? length - i : chunk_width;
 #if DEBUG_MEMORY
-        if (idx >= width * heigth * 3 || idx < 0){
+        if (pixel + row_length > width * heigth || pixel < 0){
             fprintf(stderr, "WARN: Trying to write outside bitmap buffer. idx = %d, bitmap size = %d.\n",
-                idx, width * heigth);
+                pixel * 3, width * heigth);
         }
 #endif                
-        bitmap[idx] = red;
-        bitmap[idx + 1] = green;
-        bitmap[idx + 2] = blue;
+        histogram_replace(&histogram, &iterations[pixel], &iters[i], row_length);
+        memcpy(&iterations[pixel], &iters[i], row_length);
     }
-    free(msg.data.compute_data_burst.iters);
-    redraw_window_safe();
+    if (length == chunk_width * chunk_height) chunk_known[cid] = true; // pans keep it
+}
+
+// colours the frame is drawn with, the caller holds colouring_lock
+static const palette_t *frame_colours(void){
+    if (!equalize) return &palette;
+    palette_equalize(&equalized, &palette, &histogram);
+    return &equalized;
+}
+
+// attaches to what the module offered in its startup message and reports the accepted subset back
+static void accept_module_features(module_t *module, uint8_t offered, uint8_t version){
+    uint8_t accepted = 0;
+    module->protocol_version = version >= PROTOCOL_VERSION ? PROTOCOL_VERSION : version > 1 ? version : 1;
+    shm_frame_destroy(module->shm_frame); // module (re)started with a new segment
+    module->shm_frame = NULL;
+    if ((offered & FEATURE_SHM_FRAME) && (module->shm_frame = shm_frame_attach(module->channel)) != NULL){
+        accepted |= FEATURE_SHM_FRAME;
+    }
+    accepted |= offered & (FEATURE_CODEC_RLE | FEATURE_CODEC_DELTA | FEATURE_FRAMING); // app decodes all of them
+    if (module->protocol_version >= 2) accepted |= offered & FEATURE_CANCEL; // chunk ids are unique with the tag
+    atomic_store(&module->app_to_module.framed, false); // restarted module expects bare messages
+    module->cancels_chunks = false;
+    if (offered == 0 || module->app_to_module.fd == -1) return; // module does not know MSG_FEATURES
+    message msgs[2] = {
+        {.type = MSG_FEATURES, .data.features.features = accepted, .data.features.version = module->protocol_version},
+        {.type = MSG_GET_CAPABILITIES}};
+    send_messages(&module->app_to_module, module->protocol_version >= 2 ? 2 : 1, msgs);
+    atomic_store(&module->app_to_module.framed, accepted & FEATURE_FRAMING);
+    module->cancels_chunks = accepted & FEATURE_CANCEL;
+    fprintf(stderr, "INFO: Module %d offered features 0x%02x, accepted 0x%02x, protocol v%d.\n", module->index,
+        offered, accepted, module->protocol_version);
+}
+
+// wide chunks and more than 255 chunks can be requested only from a protocol v2 module
+static bool chunks_fit_protocol(module_pool_t *pool){
+    if (!pool_accepts(pool, chunk_width, chunk_height, chunks_in_row * chunks_in_col)){
+        fprintf(stderr, "WARN: No module can compute %d chunks of %dx%d pixels. Protocol v1 modules take at most "
+            "%d chunks of %dx%d.\n", chunks_in_row * chunks_in_col, chunk_width, chunk_height, 
+            V1_MAX_CHUNK_ID + 1, V1_MAX_CHUNK_ID, V1_MAX_CHUNK_ID);
+        return false;
+    }
+    return true;
 }
 
 static void close_window_safe(void){
@@ -494,7 +1120,9 @@ static void redraw_window_safe(void){
     if (window_state != WINDOW_ACTIVE){
         return;
     }
+    pthread_mutex_lock(&window_lock);
     xwin_redraw(width, heigth, bitmap);
+    pthread_mutex_unlock(&window_lock);
 }
 
 static void open_window_safe(void){
@@ -514,32 +1142,53 @@ static void open_window_safe(void){
     }
 }
 
-static void wait_for_key_release_or_delay(int timeout_interval_ms, int max_total_delay_ms) {
-    const int period = DELAY_MS;
-    int time_passed = 0;
-    int total_time_passed = 0;
-    int r;
+// keyboard repeats the held key, sleeps until no repeat comes for timeout_interval_ms
+// true if the key was released, false if it is still held after max_total_delay_ms
+static bool wait_for_key_release_or_delay(int timeout_interval_ms, int max_total_delay_ms) {
+    struct timespec start, last_key, now;
+    uint8_t c;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    last_key = start;
 
-    while (time_passed < timeout_interval_ms && total_time_passed < max_total_delay_ms){
-        r = getchar();
-        usleep(period * 1000);
-        if (r != EOF) {
-            time_passed = 0; // key is still held
-        } else {
-            time_passed += period;
+    while (true){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int quiet = timeout_interval_ms - elapsed_ms(&last_key, &now);
+        int total = max_total_delay_ms - elapsed_ms(&start, &now);
+        if (quiet <= 0) return true;
+        if (total <= 0) return false;
+        uint32_t events = event_loop_wait(&keyboard_loop, quiet < total ? quiet : total);
+        if (events & EVENT_QUIT) return true;
+        if (events & EVENT_INPUT){
+            while (io_getc_timeout(STDIN_FILENO, 0, &c) == 1) ; // key is still held
+            clock_gettime(CLOCK_MONOTONIC, &last_key);
         }
-        total_time_passed += period;
     }           
 }
 
+// sleeps until a key is pressed, returns like io_getc_timeout(), 0 when quitting
+static int read_key(uint8_t *c){
+    if (!(event_loop_wait(&keyboard_loop, -1) & EVENT_INPUT)) return 0;
+    int r = io_getc_timeout(STDIN_FILENO, 0, c);
+    if (r != 1) event_loop_remove(&keyboard_loop, STDIN_FILENO); // stdin closed, would be ready forever
+    return r;
+}
+
+static int elapsed_ms(const struct timespec *since, const struct timespec *now){
+    return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
 static void print_help(void){
     fprintf(stderr, "\n============================= ARGUMENTS ============================\n");
-    fprintf(stderr, "  argv[1] - App to module named pipe path. Has to be opened beforehand.\n");
-    fprintf(stderr, "  argv[2] - Module to app named pipe path. Has to be opened beforehand.\n");
+    fprintf(stderr, "  argv[1] - App to module named pipe path. Has to be opened beforehand.\n"
+                    "            Or unix:/path or tcp:host:port of the listening module.\n"
+                    "            Or spawn[:workers] to start the module from the app.\n"
+                    "            Several modules are separated by '%s'.\n", MODULE_CHANNEL_SEPARATOR);
+    fprintf(stderr, "  argv[2] - Module to app named pipe path. Has to be opened beforehand.\n"
+                    "            Not used with sockets.\n");
     fprintf(stderr, "  argv[3] - Image width. Maximum is %d. Will be rounded down to nearest\n"
-                    "            mutliple of %d\n", 16*chunk_width, chunk_width);
+                    "            mutliple of %d\n", MAX_CHUNKS_IN_ROW * chunk_width, chunk_width);
     fprintf(stderr, "  argv[4] - Image height. Maximum is %d. Will be rounded down to nearest\n"
-                    "            mutliple of %d\n", 16*chunk_height, chunk_height);
+                    "            mutliple of %d\n", MAX_CHUNKS_IN_ROW * chunk_height, chunk_height);
     fprintf(stderr, "  argv[5] - Real part of lower left corner. Must be between -5 and 5.\n");
     fprintf(stderr, "  argv[6] - Imaginary part of lower left corner. Must be between -5 and 5.\n");
     fprintf(stderr, "  argv[7] - Real part of upper right corner. Must be between real part of\n"
@@ -549,6 +1198,10 @@ static void print_help(void){
     fprintf(stderr, "  argv[9] - Real part of constant in recurzive equation. Must be between -2 and 2.\n");
     fprintf(stderr, "  argv[10] - Imaginary part of constant in recurzive equation. Must be between -2 and 2.\n");
     fprintf(stderr, "  argv[11] - Maximum number of iterations of recursive equation. Must be between 1 and 255\n");
+    fprintf(stderr, "  argv[12] - Frames presented per second at most. Must be between 1 and %d, default %d.\n",
+        MAX_RENDER_FPS, RENDER_FPS);
+    fprintf(stderr, "  argv[13] - File computed chunks are cached in (default %s), '%s' to compute everything.\n",
+        tile_cache_default_path(), TILE_CACHE_DISABLED);
     fprintf(stderr, "============================= COMMANDS =============================\n");
     fprintf(stderr, "  'q' - Quit application and module.\n");
     fprintf(stderr, "  'h' - Help message.\n");
@@ -562,9 +1215,16 @@ static void print_help(void){
     fprintf(stderr, "  'r' - Redraw window with current buffer.\n");
     fprintf(stderr, "  'c' - Close window.\n");
     fprintf(stderr, "  'e' - Erase buffer.\n");
+    fprintf(stderr, "  'o' - Switch palette, recolours the current image.\n");
+    fprintf(stderr, "  'y' - Start or stop cycling the palette.\n");
+    fprintf(stderr, "  'm' - Switch between colouring by iteration count and histogram equalization.\n");
     fprintf(stderr, "  '+' - Zoom in.\n");
     fprintf(stderr, "  '-' - Zoom out.\n");
+    fprintf(stderr, "  'n' - Switch snapped navigation, zooms by 2 and pans by chunks so tiles computed\n"
+                    "        before are reused.\n");
     fprintf(stderr, "  'arrows' - Move image.\n");
+    fprintf(stderr, "  'b' - Back to the previous view.\n");
+    fprintf(stderr, "  'f' - Forward to the view left by 'b'.\n");
     fprintf(stderr, "====================================================================\n\n");
 }
 
@@ -575,7 +1235,7 @@ static void open_parameters_settings(thread_shared_data_t *data){
     int r;
     bool reprint;
     while (!data->quit){        
-        if ((r = io_getc_timeout(STDIN_FILENO, DELAY_MS, &c)) == -1){
+        if ((r = read_key(&c)) == -1){
             fprintf(stderr, "ERROR: io_getc_timeout() from stdin failed: %s\n", strerror(errno));
             continue;
         } else if (r == 0){
@@ -659,7 +1319,7 @@ for (int i = 0; i < lines; ++i) {
 static void set_chunk_size(){
     fprintf(stderr, "\n============================= SETTINGS =============================\n");
     fprintf(stderr, "Enter chunk width in pixels and chunk height in pixels. Value must be \n");
-    fprintf(stderr, "between 1 and 64.\n");
+    fprintf(stderr, "between 1 and %d (more than %d requires protocol v2 module).\n", MAX_CHUNK_SIDE, V1_MAX_CHUNK_ID);
     fprintf(stderr, "\n");    
     fprintf(stderr, "Current chunk width = %d\n", chunk_width);
     fprintf(stderr, "Current chunk height = %d\n", chunk_height);
@@ -668,11 +1328,11 @@ static void set_chunk_size(){
     fprintf(stderr, "====================================================================\n\n");
     call_termios(SET_TERMINAL_TO_DEFAULT);
     int new_width, new_height;
-    if (scanf("%d", &new_width) && new_width > 0 && new_width <= 64) {
+    if (scanf("%d", &new_width) && new_width > 0 && new_width <= MAX_CHUNK_SIDE) {
         chunk_width = new_width;
     }
 
-    if (scanf("%d", &new_height) && new_height > 0 && new_height <= 64){
+    if (scanf("%d", &new_height) && new_height > 0 && new_height <= MAX_CHUNK_SIDE){
         chunk_height = new_height;
     }
     call_termios(SET_TERMINAL_TO_RAW);
@@ -682,7 +1342,7 @@ static void set_chunk_size(){
 static void set_chunks_in_row_col(void){
     fprintf(stderr, "\n============================= SETTINGS =============================\n");
     fprintf(stderr, "Enter number of chunks in one row and number of chunks in one column.  \n");
-    fprintf(stderr, "Value must be between 1 and 16.\n");
+    fprintf(stderr, "Value must be between 1 and %d.\n", MAX_CHUNKS_IN_ROW);
     fprintf(stderr, "\n");    
     fprintf(stderr, "Current number of chunks in one row = %d\n", chunks_in_row);
     fprintf(stderr, "Current number of chunks in one colunm = %d\n", chunks_in_col);
@@ -691,11 +1351,11 @@ static void set_chunks_in_row_col(void){
     fprintf(stderr, "====================================================================\n\n");
     call_termios(SET_TERMINAL_TO_DEFAULT);
     int new_in_row, new_in_col;
-    if (scanf("%d", &new_in_row) && new_in_row > 0 && new_in_row <= 16) {
+    if (scanf("%d", &new_in_row) && new_in_row > 0 && new_in_row <= MAX_CHUNKS_IN_ROW) {
         chunks_in_row = new_in_row;
     }
 
-    if (scanf("%d", &new_in_col) && new_in_col > 0 && new_in_col <= 16){
+    if (scanf("%d", &new_in_col) && new_in_col > 0 && new_in_col <= MAX_CHUNKS_IN_ROW){
         chunks_in_col = new_in_col;
     }
     call_termios(SET_TERMINAL_TO_RAW);
@@ -792,51 +1452,269 @@ static void set_recurzive_constant(void){
     clear_settings_menu(13);
 }
 
-static void zoom_in(void){
+static bool zoom_in(void){
+    complex double old_corner = lower_left_corner, old_pixel_size = pixel_size;
     double real_diff = creal(upper_right_corner) - creal(lower_left_corner);
     double imag_diff = cimag(upper_right_corner) - cimag(lower_left_corner);
-    if (real_diff < 0.001 || imag_diff < 0.001) return;
+    if (real_diff < 0.001 || imag_diff < 0.001) return false;
+    if (snapped){
+        snap_view(snapped_level() + 1);
+        return true;
+    }
     lower_left_corner += (0.1 * real_diff + 0.1 * imag_diff * I);
     upper_right_corner -= (0.1 * real_diff + 0.1 * imag_diff * I);
     calculate_window_parameters();
+    reproject_frame(old_corner, old_pixel_size);
+    return true;
 }
-static void zoom_out(void){
+static bool zoom_out(void){
+    complex double old_corner = lower_left_corner, old_pixel_size = pixel_size;
     double real_diff = creal(upper_right_corner) - creal(lower_left_corner);
     double imag_diff = cimag(upper_right_corner) - cimag(lower_left_corner);
-    if (real_diff > 4 || imag_diff > 4) return;
+    if (real_diff > 4 || imag_diff > 4) return false;
+    if (snapped){
+        snap_view(snapped_level() - 1);
+        return true;
+    }
     lower_left_corner -= (0.125 * real_diff + 0.125 * imag_diff * I);
     upper_right_corner += (0.125 * real_diff + 0.125 * imag_diff * I);
     calculate_window_parameters();
+    reproject_frame(old_corner, old_pixel_size);
+    return true;
 }
 
-static void move_image(int direction){
-    double real_diff = creal(upper_right_corner) - creal(lower_left_corner);
-    double imag_diff = cimag(upper_right_corner) - cimag(lower_left_corner);
+// pixel size becomes 2^-level and the chunks are put on the grid of the level, the centre of the view stays
+static void snap_view(int level){
+    complex double old_corner = lower_left_corner, old_pixel_size = pixel_size;
+    complex double centre = (lower_left_corner + upper_right_corner) / 2;
+    double d = ldexp(1.0, -level);
+    double tile_re = chunk_width * d, tile_im = chunk_height * d;
+    double re = floor((creal(centre) - width * d / 2) / tile_re + 0.5) * tile_re;
+    double im = floor((cimag(centre) - heigth * d / 2) / tile_im + 0.5) * tile_im;
+    lower_left_corner = re + im * I;
+    upper_right_corner = (re + width * d) + (im + heigth * d) * I;
+    calculate_window_parameters();
+    reproject_frame(old_corner, old_pixel_size);
+}
+
+// level of the power of two nearest to the current pixel size
+static int snapped_level(void){
+    return (int)lround(-log2(fmax(creal(pixel_size), cimag(pixel_size))));
+}
+
+// the view moves by a whole number of pixels, so the counts already computed stay exact when the frame
+// is shifted with it
+static bool move_image(module_pool_t *pool, int direction){
+    int dx, dy;
+    if (!pan_view(direction, &lower_left_corner, &upper_right_corner, &dx, &dy)) return false;
+    shift_frame(pool, dx, dy);
+    return true;
+}
+
+// corners of the view panned in the direction and the shift of the frame, false at the border
+static bool pan_view(int direction, complex double *lower_left, complex double *upper_right, int *dx, int *dy){
+    int step_x = (int)lround(0.1 * width) > 0 ? (int)lround(0.1 * width) : 1;
+    int step_y = (int)lround(0.1 * heigth) > 0 ? (int)lround(0.1 * heigth) : 1;
+    if (snapped){ // chunks stay on the grid
+        step_x = chunk_width;
+        step_y = chunk_height;
+    }
+    double real_step = step_x * creal(pixel_size), imag_step = step_y * cimag(pixel_size);
+    *dx = *dy = 0;
     switch (direction)
     {
     case DIRECTION_UP:
-        if (cimag(upper_right_corner) + 0.1 * imag_diff > 5.0) break;
-        upper_right_corner += 0.1 * imag_diff * I;
-        lower_left_corner +=  0.1 * imag_diff * I;
-        break;
+        if (cimag(*upper_right) + imag_step > 5.0) return false;
+        *upper_right += imag_step * I;
+        *lower_left +=  imag_step * I;
+        *dy = -step_y;
+        return true;
     case DIRECTION_DOWN:
-        if (cimag(lower_left_corner) - 0.1 * imag_diff < -5.0) break;
-        upper_right_corner -= 0.1 * imag_diff * I;
-        lower_left_corner -=  0.1 * imag_diff * I;
-        break;
+        if (cimag(*lower_left) - imag_step < -5.0) return false;
+        *upper_right -= imag_step * I;
+        *lower_left -=  imag_step * I;
+        *dy = step_y;
+        return true;
     case DIRECTION_RIGHT:
-        if (creal(upper_right_corner) + 0.1 * real_diff > 5.0) break;
-        upper_right_corner += 0.1 * real_diff;
-        lower_left_corner +=  0.1 * real_diff;
-        break;
+        if (creal(*upper_right) + real_step > 5.0) return false;
+        *upper_right += real_step;
+        *lower_left +=  real_step;
+        *dx = step_x;
+        return true;
     case DIRECTION_LEFT:
-        if (creal(lower_left_corner) - 0.1 * real_diff < -5.0) break;
-        upper_right_corner -= 0.1 * real_diff;
-        lower_left_corner -=  0.1 * real_diff;
-        break;    
+        if (creal(*lower_left) - real_step < -5.0) return false;
+        *upper_right -= real_step;
+        *lower_left -=  real_step;
+        *dx = -step_x;
+        return true;
     default:
-        break;
+        return false;
+    }
+}
+
+// navigation that moved away from the view remembered before it forgets the views gone back from,
+// one that did not move forgets the view it has just remembered
+static void leave_view(bool moved){
+    if (moved){
+        history_clear(&history, HISTORY_FORWARD);
+    } else if (view_just_remembered){
+        history_pop(&history, HISTORY_BACK, NULL, NULL);
+        view_remembered = false;
+    }
+    view_just_remembered = false;
+}
+
+// the view a navigation starts from goes on the back stack, the views a held key passes until the
+// next view is requested are not remembered
+static void remember_left_view(void){
+    view_just_remembered = !view_remembered;
+    if (view_remembered) return;
+    remember_view(HISTORY_BACK);
+    view_remembered = true;
+}
+
+// the current view with its frame goes on the stack, the frame is copied under the lock and
+// compressed without it, so the render thread does not wait for the codecs
+static void remember_view(int stack){
+    history_view_t view = {.lower_left_corner = lower_left_corner, .upper_right_corner = upper_right_corner,
+        .constant = recurzive_eq_constant, .num_of_iterations = num_of_iterations, .width = width, 
+        .height = heigth, .chunk_width = chunk_width, .chunk_height = chunk_height};
+    uint8_t *frame = history_scratch(&history, width * heigth);
+    bool known[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    if (frame == NULL) return;
+    pthread_mutex_lock(&colouring_lock);
+    memcpy(frame, iterations, width * heigth);
+    memcpy(known, chunk_known, sizeof(known));
+    pthread_mutex_unlock(&colouring_lock);
+    history_push(&history, stack, &view, frame, known);
+}
+
+// false if the view on top of the stack was left with another frame size since, it is dropped then
+static bool view_fits(int stack){
+    const history_view_t *view = history_top(&history, stack);
+    if (view->width != width || view->height != heigth || view->chunk_width != chunk_width || 
+        view->chunk_height != chunk_height){
+        fprintf(stderr, "WARN: The view was left with another image size, it is dropped.\n");
+        history_pop(&history, stack, NULL, NULL);
+        return false;
+    }
+    return true;
+}
+
+// view on top of the stack becomes the current one with the frame it had, it must fit the frame
+static void restore_view(thread_shared_data_t *data, int stack){
+    const history_view_t *view = history_top(&history, stack);
+    lower_left_corner = view->lower_left_corner;
+    upper_right_corner = view->upper_right_corner;
+    recurzive_eq_constant = view->constant;
+    num_of_iterations = view->num_of_iterations;
+    calculate_window_parameters();
+    abort_requests(data, false); // nothing of the current view may land in the restored frame
+    pthread_mutex_lock(&colouring_lock);
+    history_pop(&history, stack, iterations, chunk_known);
+    histogram_build(&histogram, iterations, width * heigth);
+    pthread_mutex_unlock(&colouring_lock);
+    palette_update(&palette, num_of_iterations, palette_kind);
+    recolour_frame();
+    fprintf(stderr, "INFO: Went %s to a view, %d views back and %d forward are left.\n", 
+        stack == HISTORY_BACK ? "back" : "forward", history.num_of_views[HISTORY_BACK], 
+        history.num_of_views[HISTORY_FORWARD]);
+}
+
+// pixel (x, y) of the frame gets the counts of pixel (x + dx, y + dy), the exposed strip is left
+// uncomputed. A chunk stays known only if all the pixels it got come from known chunks, requested
+// chunks move with the frame if modules cancel the others.
+static void shift_frame(module_pool_t *pool, int dx, int dy){
+    bool known[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW];
+    pthread_mutex_lock(&colouring_lock);
+    for (int c_row = 0; c_row < chunks_in_col; c_row++){
+        for (int c_col = 0; c_col < chunks_in_row; c_col++){
+            int x0 = c_col * chunk_width + dx, y0 = c_row * chunk_height + dy;
+            int x1 = x0 + chunk_width - 1, y1 = y0 + chunk_height - 1;
+            bool all_known = x0 >= 0 && y0 >= 0 && x1 < width && y1 < heigth;
+            for (int row = y0 / chunk_height; all_known && row <= y1 / chunk_height; row++){
+                for (int col = x0 / chunk_width; all_known && col <= x1 / chunk_width; col++){
+                    all_known = chunk_known[row * chunks_in_row + col];
+                }
+            }
+            known[c_row * chunks_in_row + c_col] = all_known;
+        }
+    }
+    memcpy(chunk_known, known, sizeof(known));
+    if (pool_cancels_chunks(pool)){
+        bool adopted[MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW] = {false};
+        retarget_requests(pool, dx, dy, adopted);
+    }
+    int rows = heigth - abs(dy), cols = width - abs(dx);
+    if (rows <= 0 || cols <= 0){
+        memset(iterations, 0, width * heigth);
+    } else if (dy > 0){ // rows move up, the first ones are overwritten last
+        for (int row = 0; row < rows; row++){
+            memmove(&iterations[row * width + (dx < 0 ? -dx : 0)], &iterations[(row + dy) * width + 
+                (dx > 0 ? dx : 0)], cols);
+        }
+    } else {
+        for (int row = heigth - 1; row >= heigth - rows; row--){
+            memmove(&iterations[row * width + (dx < 0 ? -dx : 0)], &iterations[(row + dy) * width + 
+                (dx > 0 ? dx : 0)], cols);
+        }
+    }
+    if (rows > 0 && cols > 0){ // exposed pixels
+        for (int row = 0; row < heigth; row++){
+            if (row < -dy || row >= heigth - dy){
+                memset(&iterations[row * width], 0, width);
+            } else if (dx > 0){
+                memset(&iterations[row * width + cols], 0, dx);
+            } else if (dx < 0){
+                memset(&iterations[row * width], 0, -dx);
+            }
+        }
+    }
+    histogram_build(&histogram, iterations, width * heigth);
+    pthread_mutex_unlock(&colouring_lock);
+    recolour_frame();
+}
+
+// until the chunks of the new view arrive, the window shows the counts of the old one resampled to
+// it, the parts the old view did not cover are left uncomputed
+static void reproject_frame(complex double old_lower_left_corner, complex double old_pixel_size){
+    if (old_lower_left_corner == lower_left_corner && old_pixel_size == pixel_size) return;
+    uint8_t *reprojected = malloc(width * heigth);
+    int *old_cols = malloc(width * sizeof(int));
+    int *old_rows = malloc(heigth * sizeof(int));
+    if (reprojected == NULL || old_cols == NULL || old_rows == NULL){
+        fprintf(stderr, "FATAL ERROR: Allocation of the reprojected frame failed.\n");
+        exit(ERROR_ALLOCATION);
+    }
+    for (int col = 0; col < width; col++){
+        double re = creal(lower_left_corner) + col * creal(pixel_size);
+        old_cols[col] = (int)floor((re - creal(old_lower_left_corner)) / creal(old_pixel_size) + 0.5);
+    }
+    for (int row = 0; row < heigth; row++){ // row 0 is the top of the image
+        double im = cimag(lower_left_corner) + (heigth - 1 - row) * cimag(pixel_size);
+        old_rows[row] = heigth - 1 - 
+            (int)floor((im - cimag(old_lower_left_corner)) / cimag(old_pixel_size) + 0.5);
+    }
+    pthread_mutex_lock(&colouring_lock);
+    for (int row = 0; row < heigth; row++){
+        uint8_t *dst = &reprojected[row * width];
+        if (old_rows[row] < 0 || old_rows[row] >= heigth){
+            memset(dst, 0, width);
+            continue;
+        }
+        const uint8_t *src = &iterations[old_rows[row] * width];
+        for (int col = 0; col < width; col++){
+            dst[col] = old_cols[col] >= 0 && old_cols[col] < width ? src[old_cols[col]] : 0;
+        }
     }
+    memcpy(iterations, reprojected, width * heigth);
+    histogram_build(&histogram, iterations, width * heigth);
+    memset(chunk_known, 0, sizeof(chunk_known)); // resampled counts are only a preview
+    pthread_mutex_unlock(&colouring_lock);
+    free(reprojected);
+    free(old_cols);
+    free(old_rows);
+    recolour_frame();
 }
 
 static void save_image(void){
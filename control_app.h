@@ -2,7 +2,15 @@
 #ifndef __CONTROL_APP_H__
 #define __CONTROL_APP_H__
 
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+
 #include "common_lib.h"
+#include "module_pool.h"
+#include "palette.h"
+#include "tile_pyramid.h"
+#include "view_history.h"
 #include "xwin_sdl.h"
 
 #ifndef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -20,11 +28,19 @@
 #endif
 
 #define KEYPRESS_DELAY 100
+#define MAX_CHUNK_SIDE 1024      // pixels, more than 255 needs protocol v2
+#define MAX_CHUNKS_IN_ROW 64     // more than 255 chunks in total need protocol v2
+#define MODULE_CHANNEL_SEPARATOR "," // channels of several modules in one argument
+#define MODULE_EXEC_NAME "computational_module_exec" // started from the directory of the app
+#define MODULE_MAX_RESTARTS 3    // spawned module that keeps crashing is given up
+#define RENDER_FPS 60            // chunks are presented and the palette cycles at most this often
+#define MAX_RENDER_FPS 240
+#define PREFETCH_CID_BASE (MAX_CHUNKS_IN_ROW * MAX_CHUNKS_IN_ROW) // chunks of the predicted view, cached only
 
 typedef struct {
     atomic_bool quit;   
-    data_t module_to_app;
-    data_t app_to_module;
+    module_pool_t pool;
+    atomic_bool cycling; // palette cycling animation is running
 } thread_shared_data_t;
 
 enum {
@@ -0,0 +1,68 @@
+
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLY 0x82f63b78u // reversed Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fnc_ptr)(uint32_t crc, const uint8_t *buf, size_t size);
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *buf, size_t size);
+static void crc32c_init(void);
+
+static uint32_t table[256];
+static crc32c_fnc_ptr crc32c_impl; // resolved on the first call
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t size){
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl(crc, buf, size);
+}
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *buf, size_t size){
+    for (size_t i = 0; i < size; i++){
+        crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t size){
+    size_t i = 0;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc, word;
+    for (; i + 8 <= size; i += 8){
+        memcpy(&word, buf + i, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+#endif
+    for (; i < size; i++){
+        crc = _mm_crc32_u8(crc, buf[i]);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init(void){
+    for (uint32_t i = 0; i < 256; i++){
+        uint32_t entry = i;
+        for (int bit = 0; bit < 8; bit++){
+            entry = (entry >> 1) ^ (entry & 1 ? CRC32C_POLY : 0);
+        }
+        table[i] = entry;
+    }
+    crc32c_fnc_ptr impl = crc32c_table;
+#if CRC32C_HAVE_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) impl = crc32c_sse42;
+#endif
+    crc32c_impl = impl;
+}
@@ -0,0 +1,24 @@
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC32C (Castagnoli) used by the message framing. Computed by the SSE4.2 crc32 instruction
+// when the CPU has it, by a lookup table otherwise.
+
+#define CRC32C_INIT 0xffffffffu
+
+// continues the crc of the previous buffers, start with CRC32C_INIT and finish with crc32c_final()
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t size);
+
+static inline uint32_t crc32c_final(uint32_t crc){
+    return crc ^ 0xffffffffu;
+}
+
+static inline uint32_t crc32c(const void *buf, size_t size){
+    return crc32c_final(crc32c_update(CRC32C_INIT, buf, size));
+}
+
+#endif
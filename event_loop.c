@@ -0,0 +1,94 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "common_lib.h"
+#include "event_loop.h"
+
+static pthread_once_t quit_once = PTHREAD_ONCE_INIT;
+static int quit_event = -1;
+
+static void create_quit_event(void);
+
+bool event_loop_init(event_loop_t *loop){
+    pthread_once(&quit_once, create_quit_event);
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1){
+        fprintf(stderr, "ERROR: epoll_create1() failed: %s\n", strerror(errno));
+        return false;
+    }
+    if (quit_event != -1) event_loop_add(loop, quit_event, EVENT_QUIT);
+    return true;
+}
+
+void event_loop_destroy(event_loop_t *loop){
+    if (loop->epfd != -1) close(loop->epfd);
+    loop->epfd = -1;
+}
+
+bool event_loop_add(event_loop_t *loop, int fd, uint32_t tag){
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = tag};
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1 &&
+        (errno != EEXIST || epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) == -1)){
+        fprintf(stderr, "ERROR: Cannot watch FD %d: %s\n", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void event_loop_remove(event_loop_t *loop, int fd){
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL); // closed fd is not in the set any more
+}
+
+uint32_t event_loop_wait(event_loop_t *loop, int timeout_ms){
+    struct epoll_event events[EVENT_MAX_FDS];
+    int r = epoll_wait(loop->epfd, events, EVENT_MAX_FDS, timeout_ms);
+    if (r == -1 && errno != EINTR){
+        fprintf(stderr, "ERROR: epoll_wait() failed: %s\n", strerror(errno));
+    }
+    uint32_t tags = 0;
+    for (int i = 0; i < r; i++) tags |= events[i].data.u32; // EPOLLHUP and EPOLLERR are reported as ready
+    return tags;
+}
+
+int event_create(void){
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1){
+        fprintf(stderr, "FATAL ERROR: eventfd() failed: %s\n", strerror(errno));
+        exit(ERROR_ALLOCATION);
+    }
+    return efd;
+}
+
+void event_signal(int efd){
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) == -1 && errno != EAGAIN){
+        fprintf(stderr, "ERROR: Signalling event failed: %s\n", strerror(errno));
+    }
+}
+
+void event_clear(int efd){
+    uint64_t count;
+    if (read(efd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+        fprintf(stderr, "ERROR: Clearing event failed: %s\n", strerror(errno));
+    }
+}
+
+void event_close(int efd){
+    if (efd != -1) close(efd);
+}
+
+void event_raise_quit(atomic_bool *quit){
+    atomic_store(quit, true);
+    pthread_once(&quit_once, create_quit_event);
+    event_signal(quit_event);
+}
+
+static void create_quit_event(void){
+    quit_event = event_create();
+}
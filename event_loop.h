@@ -0,0 +1,42 @@
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Threads block in epoll_wait() on the descriptors they serve instead of polling them with short
+// timeouts. Other threads wake them through eventfd counters. Every loop also watches the quit
+// event, so raising quit wakes every blocked thread of the process at once.
+
+#define EVENT_QUIT 0x01  // tag of the quit event, present in every loop
+#define EVENT_INPUT 0x02 // tags of the descriptors the thread serves
+#define EVENT_WAKE 0x04
+#define EVENT_MAX_FDS 8
+
+typedef struct {
+    int epfd;
+} event_loop_t;
+
+// returns false if epoll cannot be created
+bool event_loop_init(event_loop_t *loop);
+void event_loop_destroy(event_loop_t *loop);
+
+// fd is reported by its tag (a bit, so that several ready fds can be returned at once)
+bool event_loop_add(event_loop_t *loop, int fd, uint32_t tag);
+void event_loop_remove(event_loop_t *loop, int fd);
+
+// waits up to timeout_ms (-1 forever), returns the tags of the ready descriptors, 0 on timeout
+uint32_t event_loop_wait(event_loop_t *loop, int timeout_ms);
+
+// eventfd wakeups, a signalled event stays readable until cleared
+int event_create(void);
+void event_signal(int efd);
+void event_clear(int efd);
+void event_close(int efd);
+
+// sets the quit flag and wakes every loop of the process, the quit event is never cleared
+void event_raise_quit(atomic_bool *quit);
+
+#endif
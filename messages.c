@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #include "messages.h"
+#include "crc32c.h"
 
 // - function  ----------------------------------------------------------------
 bool get_message_size(const message *msg, int *len)
@@ -21,6 +22,7 @@ bool get_message_size(const message *msg, int *len)
       case MSG_DONE:
       case MSG_GET_VERSION:
       case MSG_QUIT:
+      case MSG_GET_CAPABILITIES:
          *len = 2; // 2 bytes message - id + cksum
          break;
       case MSG_STARTUP:
@@ -41,6 +43,27 @@ bool get_message_size(const message *msg, int *len)
       case MSG_COMPUTE_DATA_BURST:
          *len = 2 + 2 + msg->data.compute_data_burst.length + 1; //cid + lenght + lenght * uint8_t + cksum   
          break;
+      case MSG_FEATURES:
+         *len = 2 + 2; // features bitmask, version
+         break;
+      case MSG_COMPUTE_DATA_SHM:
+         *len = 2 + 4 + 1 + 4; // cid, slot, length
+         break;
+      case MSG_COMPUTE_DATA_BURST_PACKED:
+         *len = 2 + 4 + 1 + 4 + 4 + msg->data.compute_data_burst_packed.packed_length; // cid, codec, lengths
+         break;
+      case MSG_CAPABILITIES:
+         *len = 2 + 1 + 1 + 2 + 1 + 1 + 4; // version, kernels, max iterations, codecs, transports, max pixels
+         break;
+      case MSG_COMPUTE_V2:
+         *len = 2 + 4 + 2 * sizeof(double) + 2 * 2; // cid (32bit), re, im, n_re, n_im (16bit)
+         break;
+      case MSG_COMPUTE_DATA_BURST_V2:
+         *len = 2 + 4 + 4 + msg->data.compute_data_burst.length; // cid, length (32bit), data
+         break;
+      case MSG_CANCEL:
+         *len = 2 + 4; // cid (32bit)
+         break;
       default:
          ret = false;
          break;
@@ -48,23 +71,55 @@ bool get_message_size(const message *msg, int *len)
    return ret;
 }
 
+// - function  ----------------------------------------------------------------
+int peek_message_size(const uint8_t *buf, int available, int *len)
+{
+   if (available < 1) {
+      return 0;
+   }
+   message msg = {.type = buf[0]};
+   uint16_t length16;
+   if (msg.type == MSG_COMPUTE_DATA_BURST) {
+      if (available < 3) {
+         return 0;
+      }
+      memcpy(&length16, &(buf[1]), 2);
+      msg.data.compute_data_burst.length = length16;
+   } else if (msg.type == MSG_COMPUTE_DATA_BURST_V2) {
+      if (available < 9) {
+         return 0;
+      }
+      memcpy(&msg.data.compute_data_burst.length, &(buf[5]), 4);
+      if (msg.data.compute_data_burst.length > MAX_MESSAGE_SIZE) {
+         return -1;
+      }
+   } else if (msg.type == MSG_COMPUTE_DATA_BURST_PACKED) {
+      if (available < 14) {
+         return 0;
+      }
+      memcpy(&msg.data.compute_data_burst_packed.packed_length, &(buf[10]), 4);
+      if (msg.data.compute_data_burst_packed.packed_length > MAX_MESSAGE_SIZE) {
+         return -1;
+      }
+   }
+   return get_message_size(&msg, len) ? 1 : -1;
+}
+
 // - function  ----------------------------------------------------------------
 bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len)
 {
-   if (!msg || !buf ||
-      (msg->type == MSG_COMPUTE_DATA_BURST && size < msg->data.compute_data_burst.length + 5)) {
+   if (!msg || !buf) {
       return false;
    }
-   if (msg->type != MSG_COMPUTE_DATA_BURST){
-      int needed_size;
-      if (get_message_size(msg, &needed_size) == false) {
-         fprintf(stderr, "ERROR: Unknown message type (%d).\n", msg->type);
-      }
-      if (needed_size > size){
-         fprintf(stderr, "ERROR: Needed buffer size is %d, actuall buffer size is %d.\n", needed_size, size);
-         return false;
-      } 
+   int needed_size;
+   if (get_message_size(msg, &needed_size) == false) {
+      fprintf(stderr, "ERROR: Unknown message type (%d).\n", msg->type);
+      return false;
    }
+   if (needed_size > size){
+      fprintf(stderr, "ERROR: Needed buffer size is %d, actuall buffer size is %d.\n", needed_size, size);
+      return false;
+   } 
 
    // 1st - serialize the message into a buffer
    bool ret = true;
@@ -76,6 +131,7 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len)
       case MSG_DONE:
       case MSG_GET_VERSION:
       case MSG_QUIT:
+      case MSG_GET_CAPABILITIES:
          *len = 1;
          break;
       case MSG_STARTUP:
@@ -113,13 +169,62 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len)
          buf[4] = msg->data.compute_data.iter;
          *len = 5;
          break;
-      case MSG_COMPUTE_DATA_BURST:
-         memcpy(&(buf[1]), &msg->data.compute_data_burst.length, 2);
+      case MSG_COMPUTE_DATA_BURST: {
+         uint16_t length16 = msg->data.compute_data_burst.length;
+         memcpy(&(buf[1]), &length16, 2);
          buf[3] = msg->data.compute_data_burst.chunk_id;
          memcpy(&(buf[4]), msg->data.compute_data_burst.iters, 
             msg->data.compute_data_burst.length); 
          *len = 4 + msg->data.compute_data_burst.length;
          break;
+      }
+      case MSG_FEATURES:
+         buf[1] = msg->data.features.features;
+         buf[2] = msg->data.features.version;
+         *len = 3;
+         break;
+      case MSG_COMPUTE_DATA_SHM:
+         memcpy(&(buf[1]), &msg->data.compute_data_shm.chunk_id, 4);
+         buf[5] = msg->data.compute_data_shm.slot;
+         memcpy(&(buf[6]), &msg->data.compute_data_shm.length, 4);
+         *len = 10;
+         break;
+      case MSG_COMPUTE_DATA_BURST_PACKED:
+         memcpy(&(buf[1]), &msg->data.compute_data_burst_packed.chunk_id, 4);
+         buf[5] = msg->data.compute_data_burst_packed.codec;
+         memcpy(&(buf[6]), &msg->data.compute_data_burst_packed.length, 4);
+         memcpy(&(buf[10]), &msg->data.compute_data_burst_packed.packed_length, 4);
+         memcpy(&(buf[14]), msg->data.compute_data_burst_packed.data,
+            msg->data.compute_data_burst_packed.packed_length);
+         *len = 14 + msg->data.compute_data_burst_packed.packed_length;
+         break;
+      case MSG_CAPABILITIES:
+         buf[1] = msg->data.capabilities.version;
+         buf[2] = msg->data.capabilities.kernels;
+         memcpy(&(buf[3]), &msg->data.capabilities.max_iterations, 2);
+         buf[5] = msg->data.capabilities.codecs;
+         buf[6] = msg->data.capabilities.transports;
+         memcpy(&(buf[7]), &msg->data.capabilities.max_chunk_pixels, 4);
+         *len = 11;
+         break;
+      case MSG_COMPUTE_V2:
+         memcpy(&(buf[1]), &msg->data.compute.cid, 4);
+         memcpy(&(buf[5 + 0 * sizeof(double)]), &(msg->data.compute.re), sizeof(double));
+         memcpy(&(buf[5 + 1 * sizeof(double)]), &(msg->data.compute.im), sizeof(double));
+         memcpy(&(buf[5 + 2 * sizeof(double) + 0]), &msg->data.compute.n_re, 2);
+         memcpy(&(buf[5 + 2 * sizeof(double) + 2]), &msg->data.compute.n_im, 2);
+         *len = 5 + 2 * sizeof(double) + 4;
+         break;
+      case MSG_COMPUTE_DATA_BURST_V2:
+         memcpy(&(buf[1]), &msg->data.compute_data_burst.chunk_id, 4);
+         memcpy(&(buf[5]), &msg->data.compute_data_burst.length, 4);
+         memcpy(&(buf[9]), msg->data.compute_data_burst.iters, msg->data.compute_data_burst.length);
+         *len = 9 + msg->data.compute_data_burst.length;
+         break;
+      case MSG_CANCEL:
+         memcpy(&(buf[1]), &msg->data.cancel.chunk_id, 4);
+         *len = 5;
+         break;
       default: // unknown message type
          ret = false;
          break;
@@ -127,11 +232,7 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len)
    // 2nd - send the message buffer
    if (ret) { // message recognized
       buf[0] = msg->type;
-      buf[*len] = 0; // cksum
-      for (int i = 0; i < *len; ++i) {
-         buf[*len] += buf[i];
-      }
-      buf[*len] = 255 - buf[*len]; // compute cksum
+      buf[*len] = 255 - message_cksum_update(0, buf, *len); // compute cksum
       *len += 1; // add cksum to buffer
    }
 
@@ -139,18 +240,97 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len)
 }
 
 // - function  ----------------------------------------------------------------
-bool parse_message_buf(const uint8_t *buf, int size, message *msg)
+int fill_message_iov(const message *msg, uint8_t *buf, int size, struct iovec iov[MESSAGE_IOV_MAX])
 {
-   uint8_t cksum = 0;
-   for (int i = 0; i < size; ++i) {
-      cksum += buf[i];
+   int len, header_len, length_offset, length_size;
+   const uint8_t *payload;
+   uint32_t payload_len;
+   message header = *msg;
+   switch (msg->type) {
+      case MSG_COMPUTE_DATA_BURST:
+         payload = msg->data.compute_data_burst.iters;
+         payload_len = msg->data.compute_data_burst.length;
+         header.data.compute_data_burst.length = 0;
+         header_len = 4;
+         length_offset = 1;
+         length_size = 2;
+         break;
+      case MSG_COMPUTE_DATA_BURST_V2:
+         payload = msg->data.compute_data_burst.iters;
+         payload_len = msg->data.compute_data_burst.length;
+         header.data.compute_data_burst.length = 0;
+         header_len = 9;
+         length_offset = 5;
+         length_size = 4;
+         break;
+      case MSG_COMPUTE_DATA_BURST_PACKED:
+         payload = msg->data.compute_data_burst_packed.data;
+         payload_len = msg->data.compute_data_burst_packed.packed_length;
+         header.data.compute_data_burst_packed.packed_length = 0;
+         header_len = 14;
+         length_offset = 10;
+         length_size = 4;
+         break;
+      default: // small message, serialized as a whole
+         if (!fill_message_buf(msg, buf, size, &len)) {
+            return 0;
+         }
+         iov[0].iov_base = buf;
+         iov[0].iov_len = len;
+         return 1;
+   }
+   // serialize the message with an empty payload and patch in the real payload length
+   if (!fill_message_buf(&header, buf, size, &len)) {
+      return 0;
    }
+   if (length_size == 2) {
+      uint16_t length16 = payload_len;
+      memcpy(&(buf[length_offset]), &length16, 2);
+   } else {
+      memcpy(&(buf[length_offset]), &payload_len, 4);
+   }
+   uint8_t cksum = message_cksum_update(message_cksum_update(0, buf, header_len), payload, payload_len);
+   buf[header_len] = 255 - cksum;
+   iov[0].iov_base = buf;
+   iov[0].iov_len = header_len;
+   iov[1].iov_base = (void *)payload;
+   iov[1].iov_len = payload_len;
+   iov[2].iov_base = &(buf[header_len]);
+   iov[2].iov_len = 1;
+   return 3;
+}
+
+// - function  ----------------------------------------------------------------
+uint8_t message_cksum_update(uint8_t sum, const uint8_t *buf, size_t size)
+{
+   const uint64_t mask = 0x00ff00ff00ff00ffULL;
+   size_t i = 0;
+   while (size - i >= 8) {
+      uint64_t lanes = 0; // four 16-bit lanes, each gets at most 510 per word
+      for (int words = 0; words < 128 && size - i >= 8; ++words, i += 8) {
+         uint64_t w;
+         memcpy(&w, buf + i, 8);
+         lanes += (w & mask) + ((w >> 8) & mask);
+      }
+      lanes = (lanes & 0xffff) + ((lanes >> 16) & 0xffff) + ((lanes >> 32) & 0xffff) + (lanes >> 48);
+      sum += (uint8_t)lanes;
+   }
+   for (; i < size; ++i) {
+      sum += buf[i];
+   }
+   return sum;
+}
+
+// - function  ----------------------------------------------------------------
+bool parse_message_buf(const uint8_t *buf, int size, message *msg)
+{
+   uint8_t cksum = size > 0 ? message_cksum_update(0, buf, size) : 0;
    bool ret = false;
    int message_size;
    if (
          size > 0 && cksum == 0xff && // sum of all bytes must be 255
          ((msg->type = buf[0]) >= 0) && msg->type < MSG_NBR &&
-         get_message_size(msg, &message_size) && size == message_size) {
+         peek_message_size(buf, size, &message_size) == 1 && size == message_size) {
       ret = true;
       switch(msg->type) {
          case MSG_OK:
@@ -159,6 +339,7 @@ bool parse_message_buf(const uint8_t *buf, int size, message *msg)
          case MSG_DONE:
          case MSG_GET_VERSION:
          case MSG_QUIT:
+         case MSG_GET_CAPABILITIES:
             break;
          case MSG_STARTUP:
             for (int i = 0; i < STARTUP_MSG_LEN; ++i) {
@@ -190,14 +371,63 @@ bool parse_message_buf(const uint8_t *buf, int size, message *msg)
             msg->data.compute_data.i_im = buf[3];
             msg->data.compute_data.iter = buf[4];
             break;
-         case MSG_COMPUTE_DATA_BURST:
-            memcpy(&msg->data.compute_data_burst.length, &(buf[1]), 2);
+         case MSG_COMPUTE_DATA_BURST: {
+            uint16_t length16;
+            memcpy(&length16, &(buf[1]), 2);
+            msg->data.compute_data_burst.length = length16;
             msg->data.compute_data_burst.chunk_id = buf[3];
-            uint8_t *iters = malloc(msg->data.compute_data_burst.length);
+            uint8_t *iters = malloc(length16 > 0 ? length16 : 1);
             if (!iters) return false;
             msg->data.compute_data_burst.iters = iters;
             memcpy(iters, &(buf[4]), msg->data.compute_data_burst.length);
             break;
+         }
+         case MSG_FEATURES:
+            msg->data.features.features = buf[1];
+            msg->data.features.version = buf[2];
+            break;
+         case MSG_COMPUTE_DATA_SHM:
+            memcpy(&msg->data.compute_data_shm.chunk_id, &(buf[1]), 4);
+            msg->data.compute_data_shm.slot = buf[5];
+            memcpy(&msg->data.compute_data_shm.length, &(buf[6]), 4);
+            break;
+         case MSG_COMPUTE_DATA_BURST_PACKED: {
+            msg_compute_data_burst_packed *packed = &msg->data.compute_data_burst_packed;
+            memcpy(&packed->chunk_id, &(buf[1]), 4);
+            packed->codec = buf[5];
+            memcpy(&packed->length, &(buf[6]), 4);
+            memcpy(&packed->packed_length, &(buf[10]), 4);
+            if (!(packed->data = malloc(packed->packed_length > 0 ? packed->packed_length : 1))) return false;
+            memcpy(packed->data, &(buf[14]), packed->packed_length);
+            break;
+         }
+         case MSG_CAPABILITIES:
+            msg->data.capabilities.version = buf[1];
+            msg->data.capabilities.kernels = buf[2];
+            memcpy(&msg->data.capabilities.max_iterations, &(buf[3]), 2);
+            msg->data.capabilities.codecs = buf[5];
+            msg->data.capabilities.transports = buf[6];
+            memcpy(&msg->data.capabilities.max_chunk_pixels, &(buf[7]), 4);
+            break;
+         case MSG_COMPUTE_V2:
+            memcpy(&msg->data.compute.cid, &(buf[1]), 4);
+            memcpy(&(msg->data.compute.re), &(buf[5 + 0 * sizeof(double)]), sizeof(double));
+            memcpy(&(msg->data.compute.im), &(buf[5 + 1 * sizeof(double)]), sizeof(double));
+            memcpy(&msg->data.compute.n_re, &(buf[5 + 2 * sizeof(double) + 0]), 2);
+            memcpy(&msg->data.compute.n_im, &(buf[5 + 2 * sizeof(double) + 2]), 2);
+            break;
+         case MSG_COMPUTE_DATA_BURST_V2: {
+            memcpy(&msg->data.compute_data_burst.chunk_id, &(buf[1]), 4);
+            memcpy(&msg->data.compute_data_burst.length, &(buf[5]), 4);
+            uint8_t *iters = malloc(msg->data.compute_data_burst.length > 0 ? msg->data.compute_data_burst.length : 1);
+            if (!iters) return false;
+            msg->data.compute_data_burst.iters = iters;
+            memcpy(iters, &(buf[9]), msg->data.compute_data_burst.length);
+            break;
+         }
+         case MSG_CANCEL:
+            memcpy(&msg->data.cancel.chunk_id, &(buf[1]), 4);
+            break;
          default: // unknown message type
             ret = false;
             break;
@@ -206,4 +436,42 @@ bool parse_message_buf(const uint8_t *buf, int size, message *msg)
    return ret;
 }
 
+// - function  ----------------------------------------------------------------
+void fill_frame_header(uint8_t buf[FRAME_HEADER_SIZE], uint32_t length)
+{
+   buf[0] = FRAME_SYNC_0;
+   buf[1] = FRAME_SYNC_1;
+   memcpy(&(buf[2]), &length, 4);
+   uint16_t header_crc = crc32c(buf, 6);
+   memcpy(&(buf[6]), &header_crc, 2);
+}
+
+// - function  ----------------------------------------------------------------
+int peek_frame(const uint8_t *buf, size_t available, size_t *frame_size)
+{
+   if (available >= 1 && buf[0] != FRAME_SYNC_0) {
+      return -1;
+   }
+   if (available >= 2 && buf[1] != FRAME_SYNC_1) {
+      return -1;
+   }
+   if (available < FRAME_HEADER_SIZE) {
+      return 0;
+   }
+   uint32_t length;
+   uint16_t header_crc;
+   memcpy(&length, &(buf[2]), 4);
+   memcpy(&header_crc, &(buf[6]), 2);
+   if (header_crc != (uint16_t)crc32c(buf, 6) || length < 2 || length > MAX_MESSAGE_SIZE) {
+      return -1; // corrupted length must not make the receiver wait for bytes that never come
+   }
+   *frame_size = FRAME_HEADER_SIZE + length + FRAME_TRAILER_SIZE;
+   if (available < *frame_size) {
+      return 0;
+   }
+   uint32_t crc;
+   memcpy(&crc, &(buf[FRAME_HEADER_SIZE + length]), 4);
+   return crc == crc32c(&(buf[FRAME_HEADER_SIZE]), length) ? 1 : -1;
+}
+
 /* end of messages.c */
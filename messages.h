@@ -9,6 +9,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
 
 // Definition of the communication messages
 typedef enum {
@@ -24,10 +26,46 @@ typedef enum {
    MSG_COMPUTE_DATA,     // computed result (chunk_id, result)
    MSG_COMPUTE_DATA_BURST,
    MSG_QUIT,
+   MSG_FEATURES,         // negotiated optional features (bitmask of FEATURE_*)
+   MSG_COMPUTE_DATA_SHM, // computed chunk is ready in the shared frame slot (chunk_id, slot, length)
+   MSG_COMPUTE_DATA_BURST_PACKED, // compressed burst (chunk_id, codec, length, packed length, data)
+   MSG_GET_CAPABILITIES, // request capabilities of a protocol v2 module
+   MSG_CAPABILITIES,     // protocol version, kernels, max iterations, codecs, transports, max chunk size
+   MSG_COMPUTE_V2,       // MSG_COMPUTE with 32-bit chunk id and 16-bit dimensions
+   MSG_COMPUTE_DATA_BURST_V2, // MSG_COMPUTE_DATA_BURST with 32-bit chunk id and length
+   MSG_CANCEL,           // stop computing a single chunk (chunk_id), nothing is sent for it
    MSG_NBR
 } message_type;
 
 #define STARTUP_MSG_LEN 9
+#define PROTOCOL_VERSION 2 // the last byte of the startup message, v1 modules leave it 0
+#define MAX_MESSAGE_SIZE (64 * 1024 * 1024) // larger length fields are treated as corrupted
+#define MESSAGE_IOV_MAX 3 // header, payload, cksum
+#define MESSAGE_HEADER_MAX 64 // serialized size of any message apart from the burst payload
+
+// optional features offered by the module in the startup message and accepted by MSG_FEATURES
+#define FEATURE_SHM_FRAME 0x01 // iteration data are passed through shared memory
+#define FEATURE_CODEC_RLE 0x02 // MSG_COMPUTE_DATA_BURST_PACKED with run-length codec
+#define FEATURE_CODEC_DELTA 0x04 // MSG_COMPUTE_DATA_BURST_PACKED with delta codec
+#define FEATURE_FRAMING 0x08 // messages are wrapped in CRC32C frames
+#define FEATURE_CANCEL 0x10 // module understands MSG_CANCEL
+
+// Frame: sync marker (2 bytes), message length (4 bytes), low 16 bits of CRC32C of the previous
+// six bytes, the message itself and CRC32C of the message (4 bytes). The sync marker cannot start
+// a message, so the receiver tells frames from bare messages and finds the next frame after
+// corrupted bytes.
+#define FRAME_SYNC_0 0xa5
+#define FRAME_SYNC_1 0x5a
+#define FRAME_HEADER_SIZE 8
+#define FRAME_TRAILER_SIZE 4
+
+// capabilities advertised by MSG_CAPABILITIES
+#define KERNEL_JULIA 0x01      // z = z^2 + c
+#define TRANSPORT_PIPE 0x01    // named pipes
+#define TRANSPORT_SHM 0x02     // shared memory frame
+#define TRANSPORT_UNIX 0x04    // Unix-domain stream socket
+#define TRANSPORT_TCP 0x08     // TCP socket
+#define TRANSPORT_SPAWN 0x10   // started by the app over a socketpair
 
 typedef struct {
    uint8_t major;
@@ -48,11 +86,11 @@ typedef struct {
 } msg_set_compute;
 
 typedef struct {
-   uint8_t cid; // chunk id
+   uint32_t cid; // chunk id, 8 bits in MSG_COMPUTE
    double re;    // start of the x-coords (real)
    double im;    // start of the y-coords (imaginary)
-   uint8_t n_re; // number of cells in x-coords
-   uint8_t n_im; // number of cells in y-coords
+   uint16_t n_re; // number of cells in x-coords, 8 bits in MSG_COMPUTE
+   uint16_t n_im; // number of cells in y-coords, 8 bits in MSG_COMPUTE
 } msg_compute;
 
 typedef struct {
@@ -63,11 +101,43 @@ typedef struct {
 } msg_compute_data;
 
 typedef struct {
-   uint8_t chunk_id;
-   uint16_t length; // number of pixels in the data message
+   uint32_t chunk_id; // 8 bits in MSG_COMPUTE_DATA_BURST
+   uint32_t length; // number of pixels in the data message, 16 bits in MSG_COMPUTE_DATA_BURST
    uint8_t *iters;  // pointer to the array of the compute number of iterations 
 }  msg_compute_data_burst; 
 
+typedef struct {
+   uint32_t chunk_id;
+   uint8_t codec;          // CODEC_* from burst_codec.h
+   uint32_t length;        // number of pixels after decoding
+   uint32_t packed_length; // number of bytes in data
+   uint8_t *data;          // pointer to the encoded iterations
+} msg_compute_data_burst_packed;
+
+typedef struct {
+   uint8_t features; // bitmask of FEATURE_*
+   uint8_t version;  // protocol version both sides use
+} msg_features;
+
+typedef struct {
+   uint32_t chunk_id;
+   uint8_t slot;    // index of the slot in the shared frame
+   uint32_t length; // number of pixels stored in the slot
+} msg_compute_data_shm;
+
+typedef struct {
+   uint8_t version;         // highest supported protocol version
+   uint8_t kernels;         // bitmask of KERNEL_*
+   uint16_t max_iterations;
+   uint8_t codecs;          // bitmask of FEATURE_CODEC_*
+   uint8_t transports;      // bitmask of TRANSPORT_*
+   uint32_t max_chunk_pixels;
+} msg_capabilities;
+
+typedef struct {
+   uint32_t chunk_id; // as sent in MSG_COMPUTE_V2
+} msg_cancel;
+
 typedef struct {
    uint8_t type;   // message type
    union {
@@ -77,6 +147,11 @@ typedef struct {
       msg_compute compute;
       msg_compute_data compute_data;
       msg_compute_data_burst compute_data_burst;
+      msg_features features;
+      msg_compute_data_shm compute_data_shm;
+      msg_compute_data_burst_packed compute_data_burst_packed;
+      msg_capabilities capabilities;
+      msg_cancel cancel;
    } data;
    uint8_t cksum; // checksum
 } message;
@@ -84,12 +159,30 @@ typedef struct {
 // return the size of the message in bytes
 bool get_message_size(const message *msg, int *len);
 
+// determine the size of the message whose first available bytes are in buf,
+// returns 1 on success, 0 if more bytes are needed to tell, -1 for unknown message type
+int peek_message_size(const uint8_t *buf, int available, int *len);
+
 // fill the given buf by the message msg (marhaling);
 bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len);
 
+// fill the header of the message to buf and describe the whole message by io vectors,
+// the burst payload is referenced, not copied; returns number of used vectors, 0 on error
+int fill_message_iov(const message *msg, uint8_t *buf, int size, struct iovec iov[MESSAGE_IOV_MAX]);
+
+// add bytes of buf to the additive checksum sum, processes 8 bytes at once
+uint8_t message_cksum_update(uint8_t sum, const uint8_t *buf, size_t size);
+
 // parse the message from buf to msg (unmarshaling)
 bool parse_message_buf(const uint8_t *buf, int size, message *msg);
 
+// fill the frame header for the message of the given length
+void fill_frame_header(uint8_t buf[FRAME_HEADER_SIZE], uint32_t length);
+
+// check the frame in buf, returns 1 for valid frame of frame_size bytes, 0 if more bytes are
+// needed (frame_size is set once the header is valid), -1 if buf does not start a valid frame
+int peek_frame(const uint8_t *buf, size_t available, size_t *frame_size);
+
 #endif
 
 /* end of messages.h */
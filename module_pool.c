@@ -0,0 +1,435 @@
+
+#include <time.h>
+
+#include "module_pool.h"
+
+static double now_s(void);
+static int inflight_limit(const module_t *module);
+static bool module_fits(const module_t *module, const message *chunk);
+static uint32_t chunk_pixels(const message *chunk);
+static uint32_t pending_pixels(const module_t *module);
+static void requeue_inflight(module_pool_t *pool, module_t *module, int idx);
+static int32_t claim_target(uint32_t cid, const int32_t *targets, uint32_t num_of_cids, bool *adopted);
+static void retarget_queued(void *entry, void *arg);
+
+#define POOL_CANCELLED_CID UINT32_MAX // queued chunks are marked with it before they are erased
+
+typedef struct {
+    const int32_t *targets;
+    uint32_t num_of_cids;
+    bool *adopted;
+} retarget_t;
+
+void pool_init(module_pool_t *pool, queue_t *queue, atomic_bool *quit){
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->quit = quit;
+    pool->queue = queue;
+    pool->num_of_modules = 0;
+    pool->has_compute_setup = false;
+    pool->generation = 0;
+}
+
+void pool_destroy(module_pool_t *pool){
+    for (int i = 0; i < pool->num_of_modules; i++){
+        module_t *module = &pool->modules[i];
+        fprintf(stderr, "INFO: Module %d computed %u chunk(s), last measured %.0f pixels/s.\n", i,
+            module->chunks_done, module->rate);
+        close_channel(&module->module_to_app, &module->app_to_module);
+        if (module->pid > 0 && !transport_reap(module->pid, TRANSPORT_REAP_TIMEOUT_MS)){ // hangup makes it exit
+            shm_frame_remove(module->spawned_name);
+        }
+        pthread_mutex_destroy(&module->app_to_module.lock);
+        pthread_mutex_destroy(&module->module_to_app.lock);
+        read_buffer_destroy(&module->module_to_app);
+        shm_frame_destroy(module->shm_frame);
+    }
+    pthread_mutex_destroy(&pool->lock);
+}
+
+module_t *pool_add(module_pool_t *pool, const char *channel){
+    if (pool->num_of_modules >= MAX_MODULES){
+        fprintf(stderr, "WARN: At most %d modules are supported, '%s' is ignored.\n", MAX_MODULES, channel);
+        return NULL;
+    }
+    module_t *module = &pool->modules[pool->num_of_modules];
+    memset(module, 0, sizeof(module_t));
+    module->index = pool->num_of_modules++;
+    module->pool = pool;
+    module->channel = channel;
+    module->app_to_module.fd = -1;
+    module->module_to_app.fd = -1;
+    module->pid = -1;
+    atomic_store(&module->app_to_module.framed, false);
+    atomic_store(&module->module_to_app.framed, false);
+    atomic_store(&module->app_to_module.hangup, false);
+    atomic_store(&module->module_to_app.hangup, false);
+    pthread_mutex_init(&module->app_to_module.lock, NULL);
+    pthread_mutex_init(&module->module_to_app.lock, NULL);
+    module->num_of_threads = 1;
+    module->protocol_version = 1;
+    module->max_chunk_pixels = V1_MAX_CHUNK_ID * V1_MAX_CHUNK_ID;
+    return module;
+}
+
+void pool_module_ready(module_pool_t *pool, module_t *module, uint8_t num_of_threads, uint8_t version){
+    pthread_mutex_lock(&pool->lock);
+    while (module->num_inflight > 0) requeue_inflight(pool, module, 0); // restarted module forgot them
+    module->num_of_threads = num_of_threads > 0 ? num_of_threads : 1;
+    module->protocol_version = version;
+    module->max_chunk_pixels = V1_MAX_CHUNK_ID * V1_MAX_CHUNK_ID; // until MSG_CAPABILITIES
+    module->rate = 0;
+    module->busy_since = 0;
+    module->last_cid_valid = false;
+    module->aborts_sent = 0; // restarted module does not answer the old ones
+    module->num_of_cancels = 0;
+    module->alive = true;
+    bool has_compute_setup = pool->has_compute_setup;
+    message compute_setup = pool->compute_setup;
+    pthread_mutex_unlock(&pool->lock);
+    if (has_compute_setup) send_message(&module->app_to_module, compute_setup);
+    pool_dispatch(pool);
+}
+
+void pool_module_lost(module_pool_t *pool, module_t *module){
+    pthread_mutex_lock(&pool->lock);
+    if (!module->alive){
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    module->alive = false;
+    int lost = module->num_inflight;
+    while (module->num_inflight > 0) requeue_inflight(pool, module, 0);
+    pthread_mutex_unlock(&pool->lock);
+    fprintf(stderr, "WARN: Module %d is lost, %d chunk(s) given to other modules.\n", module->index, lost);
+    pool_dispatch(pool);
+}
+
+bool pool_connected(module_pool_t *pool){
+    for (int i = 0; i < pool->num_of_modules; i++){
+        if (pool->modules[i].app_to_module.fd != -1) return true;
+    }
+    return false;
+}
+
+bool pool_idle(module_pool_t *pool){
+    bool idle = queue_size(pool->queue) == 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; idle && i < pool->num_of_modules; i++){
+        if (pool->modules[i].num_inflight > 0) idle = false;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return idle;
+}
+
+bool pool_filters_stale(module_pool_t *pool){
+    bool filters = false;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->num_of_modules; i++){
+        if (!pool->modules[i].alive) continue;
+        if (pool->modules[i].protocol_version < 2){ // 8 bit chunk ids have no room for the tag
+            filters = false;
+            break;
+        }
+        filters = true;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return filters;
+}
+
+bool pool_cancels_chunks(module_pool_t *pool){
+    bool cancels = false;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->num_of_modules; i++){
+        if (!pool->modules[i].alive) continue;
+        if (!pool->modules[i].cancels_chunks){
+            cancels = false;
+            break;
+        }
+        cancels = true;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return cancels;
+}
+
+void pool_broadcast(module_pool_t *pool, message msg){
+    for (int i = 0; i < pool->num_of_modules; i++){
+        module_t *module = &pool->modules[i];
+        if (module->app_to_module.fd == -1) continue;
+        if (!send_message(&module->app_to_module, msg) && module->app_to_module.fd == -1){
+            pool_module_lost(pool, module);
+        }
+    }
+}
+
+void pool_set_compute(module_pool_t *pool, message msg){
+    pthread_mutex_lock(&pool->lock);
+    pool->compute_setup = msg;
+    pool->has_compute_setup = true;
+    pthread_mutex_unlock(&pool->lock);
+    pool_broadcast(pool, msg);
+}
+
+bool pool_accepts(module_pool_t *pool, uint16_t chunk_width, uint16_t chunk_height, uint32_t num_of_chunks){
+    message last = {.type = MSG_COMPUTE_V2, .data.compute.cid = num_of_chunks > 0 ? num_of_chunks - 1 : 0,
+        .data.compute.n_re = chunk_width, .data.compute.n_im = chunk_height};
+    bool accepts = false;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->num_of_modules && !accepts; i++){
+        accepts = pool->modules[i].alive && module_fits(&pool->modules[i], &last);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return accepts;
+}
+
+void pool_dispatch(module_pool_t *pool){
+    message out[MAX_MODULES][2 * MODULE_MAX_INFLIGHT]; // cancels go before the new chunks
+    int count[MAX_MODULES] = {0};
+    double now = now_s(), mean_rate = 0;
+    int known = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->num_of_modules; i++){
+        if (pool->modules[i].alive && pool->modules[i].rate > 0){
+            mean_rate += pool->modules[i].rate;
+            known++;
+        }
+    }
+    mean_rate = known > 0 ? mean_rate / known : 0;
+    for (int i = 0; i < pool->num_of_modules; i++){
+        module_t *module = &pool->modules[i];
+        for (int j = 0; j < module->num_of_cancels; j++){
+            out[i][count[i]++] = (message){.type = MSG_CANCEL, .data.cancel.chunk_id = module->cancels[j]};
+        }
+        module->num_of_cancels = 0;
+    }
+
+    message *chunk;
+    while ((chunk = queue_pop(pool->queue)) != NULL){
+        module_t *best = NULL;
+        double best_finish = 0;
+        for (int i = 0; i < pool->num_of_modules; i++){
+            module_t *module = &pool->modules[i];
+            if (!module->alive || module->num_inflight >= inflight_limit(module) || !module_fits(module, chunk)){
+                continue;
+            }
+            // modules without a measurement yet are expected to be as fast as the average one,
+            // before anything is measured the chunks are spread by number of worker threads
+            double rate = module->rate > 0 ? module->rate : mean_rate > 0 ? mean_rate : module->num_of_threads;
+            double finish = (pending_pixels(module) + chunk_pixels(chunk)) / rate;
+            if (best == NULL || finish < best_finish){
+                best = module;
+                best_finish = finish;
+            }
+        }
+        if (best == NULL){ // every module is full, the chunk waits for the next MSG_DONE
+            queue_push(pool->queue, chunk);
+            break;
+        }
+        if (best->num_inflight == 0) best->busy_since = now;
+        message *sent = &out[best->index][count[best->index]++];
+        *sent = *chunk;
+        sent->type = best->protocol_version >= 2 ? MSG_COMPUTE_V2 : MSG_COMPUTE;
+        if (best->protocol_version >= 2){
+            sent->data.compute.cid |= (uint32_t)pool->generation << POOL_CHUNK_ID_BITS;
+        }
+        best->inflight[best->num_inflight++] = (inflight_chunk_t){.chunk = *chunk, 
+            .sent_cid = sent->data.compute.cid, .sent_at = now};
+        free(chunk);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_of_modules; i++){
+        if (count[i] == 0) continue;
+#if DEBUG_MULTITHREADING
+        fprintf(stderr, "DEBUG: Sending %d chunk(s) to module %d.\n", count[i], i);
+#endif
+        if (!send_messages(&pool->modules[i].app_to_module, count[i], out[i])){
+            pool_module_lost(pool, &pool->modules[i]);
+        }
+    }
+}
+
+bool pool_chunk_received(module_pool_t *pool, module_t *module, uint32_t *cid){
+    pthread_mutex_lock(&pool->lock);
+    bool current = true;
+    module->last_cid = *cid;
+    if (module->protocol_version >= 2){ // chunk may have been kept by later requests under another cid
+        current = false;
+        for (int i = 0; i < module->num_inflight && !current; i++){
+            if (module->inflight[i].sent_cid != *cid) continue;
+            *cid = module->inflight[i].chunk.data.compute.cid;
+            current = true;
+        }
+        if (!current) *cid &= (1u << POOL_CHUNK_ID_BITS) - 1;
+    }
+    module->last_cid_valid = current; // MSG_DONE of a stale chunk must not complete its new request
+    pthread_mutex_unlock(&pool->lock);
+    return current;
+}
+
+void pool_chunk_done(module_pool_t *pool, module_t *module){
+    double now = now_s();
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; module->last_cid_valid && i < module->num_inflight; i++){
+        if (module->inflight[i].sent_cid != module->last_cid) continue;
+        double elapsed = now - module->busy_since;
+        if (elapsed > 0){
+            double sample = chunk_pixels(&module->inflight[i].chunk) / elapsed;
+            module->rate = module->rate > 0 ? module->rate + MODULE_RATE_SMOOTHING * (sample - module->rate) : sample;
+        }
+        module->inflight[i] = module->inflight[--module->num_inflight];
+        module->busy_since = now;
+        module->chunks_done++;
+        break;
+    }
+    module->last_cid_valid = false; // chunks of an aborted computation are ignored
+    pthread_mutex_unlock(&pool->lock);
+    pool_dispatch(pool);
+}
+
+void pool_abort(module_pool_t *pool){
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++;
+    for (int i = 0; i < pool->num_of_modules; i++){
+        pool->modules[i].num_inflight = 0;
+        pool->modules[i].last_cid_valid = false;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_send_abort(module_pool_t *pool){
+    message msg = {.type = MSG_ABORT};
+    for (int i = 0; i < pool->num_of_modules; i++){
+        module_t *module = &pool->modules[i];
+        if (module->app_to_module.fd == -1) continue;
+        pthread_mutex_lock(&pool->lock);
+        module->aborts_sent++;
+        pthread_mutex_unlock(&pool->lock);
+        if (!send_message(&module->app_to_module, msg) && module->app_to_module.fd == -1){
+            pool_module_lost(pool, module);
+        }
+    }
+}
+
+bool pool_abort_answered(module_pool_t *pool, module_t *module){
+    pthread_mutex_lock(&pool->lock);
+    bool answer = module->aborts_sent > 0;
+    if (answer) module->aborts_sent--;
+    pthread_mutex_unlock(&pool->lock);
+    return answer;
+}
+
+void pool_reassign_stalled(module_pool_t *pool){
+    double now = now_s();
+    int alive = 0, reassigned = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < pool->num_of_modules; i++) alive += pool->modules[i].alive;
+    for (int i = 0; i < pool->num_of_modules && alive > 1; i++){ // single module has nobody to give them to
+        module_t *module = &pool->modules[i];
+        uint32_t ahead = 0;
+        for (int j = 0; module->alive && j < module->num_inflight; ){
+            ahead += chunk_pixels(&module->inflight[j].chunk);
+            double timeout = module->rate > 0 ? MODULE_STALL_FACTOR * ahead / module->rate :
+                MODULE_STALL_UNKNOWN_MS / 1000.0;
+            if (timeout < MODULE_STALL_MIN_MS / 1000.0) timeout = MODULE_STALL_MIN_MS / 1000.0;
+            if (now - module->inflight[j].sent_at <= timeout){
+                j++;
+                continue;
+            }
+            fprintf(stderr, "WARN: Module %d is stalling, chunk %u is reassigned.\n", module->index,
+                module->inflight[j].chunk.data.compute.cid);
+            requeue_inflight(pool, module, j);
+            module->rate /= 2; // it gets less work until it proves otherwise
+            reassigned++;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (reassigned > 0) pool_dispatch(pool);
+}
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int inflight_limit(const module_t *module){
+    int limit = module->num_of_threads * MODULE_INFLIGHT_PER_THREAD;
+    return limit < MODULE_MAX_INFLIGHT ? limit : MODULE_MAX_INFLIGHT;
+}
+
+static bool module_fits(const module_t *module, const message *chunk){
+    const msg_compute *compute = &chunk->data.compute;
+    if (module->protocol_version < 2 && (compute->cid > V1_MAX_CHUNK_ID || compute->n_re > V1_MAX_CHUNK_ID ||
+        compute->n_im > V1_MAX_CHUNK_ID)){
+        return false;
+    }
+    return chunk_pixels(chunk) <= module->max_chunk_pixels;
+}
+
+static uint32_t chunk_pixels(const message *chunk){
+    return (uint32_t)chunk->data.compute.n_re * chunk->data.compute.n_im;
+}
+
+static uint32_t pending_pixels(const module_t *module){
+    uint32_t pixels = 0;
+    for (int i = 0; i < module->num_inflight; i++) pixels += chunk_pixels(&module->inflight[i].chunk);
+    return pixels;
+}
+
+void pool_retarget(module_pool_t *pool, const int32_t *targets, uint32_t num_of_cids, bool *adopted){
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++; // chunks requested from now on are told from the kept ones
+    for (int i = 0; i < pool->num_of_modules; i++){
+        module_t *module = &pool->modules[i];
+        for (int j = 0; j < module->num_inflight; ){
+            message *chunk = &module->inflight[j].chunk;
+            int32_t target = claim_target(chunk->data.compute.cid, targets, num_of_cids, adopted);
+            if (target >= 0){
+                chunk->data.compute.cid = target;
+                j++;
+                continue;
+            }
+            module->cancels[module->num_of_cancels++] = module->inflight[j].sent_cid;
+            module->inflight[j] = module->inflight[--module->num_inflight];
+        }
+        if (module->num_inflight == 0) module->busy_since = 0;
+    }
+    // dispatch cannot take chunks from the queue while the pool is locked
+    retarget_t retarget = {.targets = targets, .num_of_cids = num_of_cids, .adopted = adopted};
+    pthread_mutex_lock(&pool->queue->lock);
+    forEach(pool->queue->q, retarget_queued, &retarget);
+    pthread_mutex_unlock(&pool->queue->lock);
+    message cancelled = {.data.compute.cid = POOL_CANCELLED_CID};
+    queue_erase(pool->queue, &cancelled);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// caller holds the pool lock
+static void requeue_inflight(module_pool_t *pool, module_t *module, int idx){
+    message *chunk = malloc(sizeof(message));
+    if (chunk == NULL){
+        fprintf(stderr, "FATAL ERROR: Allocation failed.\n");
+        exit(ERROR_ALLOCATION);
+    }
+    *chunk = module->inflight[idx].chunk;
+    queue_push(pool->queue, chunk);
+    module->inflight[idx] = module->inflight[--module->num_inflight];
+    if (module->num_inflight == 0) module->busy_since = 0;
+}
+
+static int32_t claim_target(uint32_t cid, const int32_t *targets, uint32_t num_of_cids, bool *adopted){
+    int32_t target = cid < num_of_cids ? targets[cid] : -1;
+    if (target < 0 || adopted[target]) return -1;
+    adopted[target] = true;
+    return target;
+}
+
+// queued chunk gets its new cid or is marked to be erased
+static void retarget_queued(void *entry, void *arg){
+    message *chunk = entry;
+    retarget_t *retarget = arg;
+    int32_t target = claim_target(chunk->data.compute.cid, retarget->targets, retarget->num_of_cids, 
+        retarget->adopted);
+    chunk->data.compute.cid = target >= 0 ? (uint32_t)target : POOL_CANCELLED_CID;
+}
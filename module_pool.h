@@ -0,0 +1,131 @@
+
+#ifndef __MODULE_POOL_H__
+#define __MODULE_POOL_H__
+
+#include "common_lib.h"
+#include "transport.h"
+
+// Computational modules the control app spreads the chunks over. Every module keeps up to
+// MODULE_INFLIGHT_PER_THREAD chunks per worker thread, the next chunk goes to the module expected
+// to finish it first according to its measured pixels per second. Chunks of a module that dies
+// or stops answering are given to the others.
+
+#define MAX_MODULES 8
+#define MODULE_MAX_INFLIGHT 32
+#define MODULE_INFLIGHT_PER_THREAD 2  // next chunk is already in the pipe when a worker finishes
+#define MODULE_RATE_SMOOTHING 0.25    // weight of the newest throughput sample
+#define MODULE_STALL_FACTOR 8         // chunk is reassigned after 8x the time it should take
+#define MODULE_STALL_MIN_MS 2000
+#define MODULE_STALL_UNKNOWN_MS 10000 // before the throughput of the module is known
+#define V1_MAX_CHUNK_ID 255           // MSG_COMPUTE carries chunk id and dimensions in one byte
+#define POOL_STALL_CHECK_MS 250       // idle reader looks for stalled chunks this often
+#define POOL_CHUNK_ID_BITS 16         // v2 chunk ids carry the generation of the request above these
+
+struct module_pool;
+
+typedef struct {
+    message chunk;  // MSG_COMPUTE_V2 as requested, the cid is the one of the current request
+    uint32_t sent_cid; // as the module knows it, with the generation tag
+    double sent_at; // seconds, monotonic
+} inflight_chunk_t;
+
+typedef struct {
+    data_t module_to_app;
+    data_t app_to_module;
+    struct module_pool *pool;
+    int index;
+    const char *channel;    // identifies the shared frame of the module
+    const char *reply_channel; // module to app named pipe, pipes only
+    bool open_failed;
+    shm_frame_t *shm_frame;
+    // modules started by the app itself
+    const char *spawn;      // "spawn[:workers]" it was started with, NULL otherwise
+    pid_t pid;
+    int restarts;
+    char spawned_name[32];  // channel of the running process
+    // set with the startup and capabilities messages
+    uint8_t num_of_threads;
+    uint8_t protocol_version;
+    uint32_t max_chunk_pixels;
+    bool cancels_chunks;    // accepted FEATURE_CANCEL
+    // guarded by the pool lock
+    bool alive;             // startup message received and channel open
+    inflight_chunk_t inflight[MODULE_MAX_INFLIGHT];
+    int num_inflight;
+    uint32_t last_cid;      // chunk whose data came last, the following MSG_DONE refers to it
+    bool last_cid_valid;
+    int aborts_sent;        // MSG_ABORT the module has not answered yet
+    uint32_t cancels[MODULE_MAX_INFLIGHT]; // chunks to be cancelled by the next pool_dispatch()
+    int num_of_cancels;
+    double rate;            // pixels per second, 0 until the first chunk is done
+    double busy_since;      // start of the interval the next throughput sample is measured over
+    unsigned chunks_done;
+} module_t;
+
+typedef struct module_pool {
+    pthread_mutex_t lock;
+    atomic_bool *quit;
+    queue_t *queue;         // chunks waiting for a module
+    message compute_setup;  // last MSG_SET_COMPUTE, (re)started modules get it before any chunk
+    bool has_compute_setup;
+    uint16_t generation;    // bumped by every abort, data of older chunks is stale
+    int num_of_modules;
+    module_t modules[MAX_MODULES];
+} module_pool_t;
+
+void pool_init(module_pool_t *pool, queue_t *queue, atomic_bool *quit);
+void pool_destroy(module_pool_t *pool);
+
+// adds the module before its channel is opened, returns NULL if there are MAX_MODULES already
+module_t *pool_add(module_pool_t *pool, const char *channel);
+
+// the module has sent its startup message or has been lost
+void pool_module_ready(module_pool_t *pool, module_t *module, uint8_t num_of_threads, uint8_t version);
+void pool_module_lost(module_pool_t *pool, module_t *module);
+
+bool pool_connected(module_pool_t *pool);
+
+// no chunk is waiting or being computed, the last requested frame is complete
+bool pool_idle(module_pool_t *pool);
+
+// every module tags its chunks with the generation, so data of aborted requests is recognised
+bool pool_filters_stale(module_pool_t *pool);
+
+// every module cancels single chunks, so the next request may keep the chunks it shares with the last one
+bool pool_cancels_chunks(module_pool_t *pool);
+void pool_broadcast(module_pool_t *pool, message msg);
+
+// broadcasts MSG_SET_COMPUTE and keeps it for modules that connect later
+void pool_set_compute(module_pool_t *pool, message msg);
+
+// true if some module can compute chunks of the given size and count
+bool pool_accepts(module_pool_t *pool, uint16_t chunk_width, uint16_t chunk_height, uint32_t num_of_chunks);
+
+// sends queued chunks to the modules with free capacity
+void pool_dispatch(module_pool_t *pool);
+
+// data of chunk cid arrived, the following MSG_DONE completes it. Returns false for data of a chunk
+// aborted or cancelled since, otherwise cid becomes the one the chunk has in the current request.
+bool pool_chunk_received(module_pool_t *pool, module_t *module, uint32_t *cid);
+void pool_chunk_done(module_pool_t *pool, module_t *module);
+
+// forgets the chunks in flight, modules are aborting them and whatever they still send is stale
+void pool_abort(module_pool_t *pool);
+
+// chunks requested so far, queued or in flight, get the cid targets[cid] in the new request. Those
+// with a negative target, a cid of num_of_cids or more or a target another chunk got already are
+// erased from the queue or cancelled by the next pool_dispatch(). adopted[target], cleared by the
+// caller, is set for every chunk kept.
+void pool_retarget(module_pool_t *pool, const int32_t *targets, uint32_t num_of_cids, bool *adopted);
+
+// sends MSG_ABORT, so modules stop computing chunks the app has already forgotten
+void pool_send_abort(module_pool_t *pool);
+
+// MSG_ABORT came from the module, true if it answers pool_send_abort(), false if the module has
+// aborted on its own and the chunks in flight are lost
+bool pool_abort_answered(module_pool_t *pool, module_t *module);
+
+// gives chunks that take too long to other modules
+void pool_reassign_stalled(module_pool_t *pool);
+
+#endif
@@ -0,0 +1,100 @@
+
+#include <string.h>
+
+#include "palette.h"
+
+static uint8_t clamp_colour(double value);
+
+static const char *palette_names[PALETTE_NBR] = {"polynomial", "fire", "grey"};
+
+void palette_update(palette_t *palette, uint8_t num_of_iterations, uint8_t kind){
+    if (num_of_iterations == 0 || kind >= PALETTE_NBR || 
+        (palette->num_of_iterations == num_of_iterations && palette->kind == kind)) return;
+    for (int i = 0; i < PALETTE_SIZE; i++){
+        // counts above the maximum cannot be computed, they get the colour of the maximum
+        double t = (double)(i < num_of_iterations ? i : num_of_iterations) / num_of_iterations;
+        uint8_t *c = palette->rgb[i];
+        switch (kind)
+        {
+        case PALETTE_POLYNOMIAL:
+            c[0] = (uint8_t) 9 * (1 - t) * t * t * t * 255;
+            c[1] = (uint8_t) 15 * (1 - t) * (1 - t) * t * t * 255;
+            c[2] = (uint8_t) 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
+            break;
+        case PALETTE_FIRE:
+            c[0] = clamp_colour(3 * t);
+            c[1] = clamp_colour(3 * t - 1);
+            c[2] = clamp_colour(3 * t - 2);
+            break;
+        case PALETTE_GREY:
+            c[0] = c[1] = c[2] = clamp_colour(t);
+            break;
+        }
+        if (i >= num_of_iterations) c[0] = c[1] = c[2] = 0; // points of the set are black
+        c[3] = 0;
+    }
+    palette->num_of_iterations = num_of_iterations;
+    palette->kind = kind;
+}
+
+const char *palette_name(uint8_t kind){
+    return kind < PALETTE_NBR ? palette_names[kind] : "unknown";
+}
+
+void palette_rotate(palette_t *out, const palette_t *in, int offset){
+    int n = in->num_of_iterations;
+    *out = *in;
+    if (n == 0) return;
+    for (int i = 0; i < n; i++){
+        memcpy(out->rgb[i], in->rgb[(i + offset) % n], 4);
+    }
+}
+
+void histogram_reset(histogram_t *histogram, uint32_t pixels){
+    memset(histogram->counts, 0, sizeof(histogram->counts));
+    histogram->uncomputed = pixels;
+}
+
+void histogram_build(histogram_t *histogram, const uint8_t *iters, int length){
+    memset(histogram->counts, 0, sizeof(histogram->counts));
+    histogram->uncomputed = 0;
+    for (int i = 0; i < length; i++){
+        histogram->counts[iters[i]]++;
+    }
+}
+
+void histogram_replace(histogram_t *histogram, const uint8_t *old_iters, const uint8_t *new_iters, int length){
+    for (int i = 0; i < length; i++){
+        // a pixel left 0 is taken as uncomputed while there are some
+        if (old_iters[i] == 0 && histogram->uncomputed > 0) histogram->uncomputed--;
+        else histogram->counts[old_iters[i]]--;
+        histogram->counts[new_iters[i]]++;
+    }
+}
+
+void palette_equalize(palette_t *out, const palette_t *in, const histogram_t *histogram){
+    int n = in->num_of_iterations;
+    uint64_t escaped = 0; // points of the set never escape and are left out
+    *out = *in;
+    for (int i = 0; i < n; i++) escaped += histogram->counts[i];
+    if (escaped == 0) return;
+    uint64_t below = 0;
+    for (int i = 0; i < n; i++){
+        below += histogram->counts[i];
+        memcpy(out->rgb[i], in->rgb[(below * (n - 1)) / escaped], 4);
+    }
+}
+
+void palette_colour_row(const palette_t *palette, const uint8_t *iters, int length, uint8_t *rgb){
+    if (length <= 0) return;
+    int i;
+    // every pixel is stored as 4 bytes, the extra one is overwritten by the next pixel
+    for (i = 0; i < length - 1; i++, rgb += 3){
+        memcpy(rgb, palette->rgb[iters[i]], 4);
+    }
+    memcpy(rgb, palette->rgb[iters[i]], 3); // last pixel must not touch the neighbouring chunk
+}
+
+static uint8_t clamp_colour(double value){ // 0..1 to 0..255
+    return value <= 0 ? 0 : value >= 1 ? 255 : (uint8_t)(value * 255);
+}
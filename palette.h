@@ -0,0 +1,56 @@
+
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Colours of the iteration counts. Every count a module can send has its RGB value precomputed,
+// so colouring a pixel is a single table lookup instead of the polynomial evaluation.
+
+#define PALETTE_SIZE 256 // iteration counts are sent in one byte
+
+enum {
+    PALETTE_POLYNOMIAL, // dark blue through green to orange, the original colouring
+    PALETTE_FIRE,       // black through red and yellow to white
+    PALETTE_GREY,
+    PALETTE_NBR
+};
+
+typedef struct {
+    uint8_t rgb[PALETTE_SIZE][4]; // 4th byte lets a pixel be copied as one 32-bit word
+    uint8_t num_of_iterations;    // the table was built for, 0 if not built yet
+    uint8_t kind;                 // PALETTE_*
+} palette_t;
+
+// rebuilds the table only if num_of_iterations or kind differs from the ones it was built for
+void palette_update(palette_t *palette, uint8_t num_of_iterations, uint8_t kind);
+
+const char *palette_name(uint8_t kind);
+
+// out gets the colours of in shifted by offset counts, points of the set stay black
+void palette_rotate(palette_t *out, const palette_t *in, int offset);
+
+// equalized colouring spreads the pixels of the frame evenly over the colours of the palette
+typedef struct {
+    uint32_t counts[PALETTE_SIZE]; // pixels of the frame with the given iteration count
+    uint32_t uncomputed;           // pixels still 0 since the reset, they are not counted
+} histogram_t;
+
+// frame of the given number of pixels has not been computed yet, none of them is counted
+void histogram_reset(histogram_t *histogram, uint32_t pixels);
+
+// histogram of length pixels with the given counts
+void histogram_build(histogram_t *histogram, const uint8_t *iters, int length);
+
+// length pixels changed their counts from old_iters to new_iters
+void histogram_replace(histogram_t *histogram, const uint8_t *old_iters, const uint8_t *new_iters, int length);
+
+// out maps every count to the colour of in at the count's rank among the escaped pixels, 
+// only PALETTE_SIZE entries are touched however large the frame is
+void palette_equalize(palette_t *out, const palette_t *in, const histogram_t *histogram);
+
+// colours length consecutive pixels of one bitmap row, rgb has 3 bytes per pixel
+void palette_colour_row(const palette_t *palette, const uint8_t *iters, int length, uint8_t *rgb);
+
+#endif
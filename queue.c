@@ -132,7 +132,8 @@ bool insert(void *queue, void *entry){
 }
 
 /*
- * Erase all entries with the value entry, if such exists
+ * Erase all entries with the value entry, if such exists. The erased
+ * entries are released as in clear().
  * return: true on success; false to indicate no such value has been removed
  */
 bool erase(void *queue, void *entry){
@@ -146,6 +147,7 @@ bool erase(void *queue, void *entry){
             matching = node;
             node = node->next;
             erased_smt = true;
+            if (q->clear != NULL) q->clear(matching->content);
             if (matching == q->head) {
                 free(q->head);
                 q->head = node;
@@ -185,6 +187,18 @@ void* getEntry(const void *queue, int idx){
     return NULL;
 }
  
+/*
+ * Call visit with every stored item and arg, from the head of the queue
+ * to the tail. The items may be changed but not removed by visit.
+ */
+void forEach(void *queue, void (*visit)(void *, void *), void *arg){
+    if (queue == NULL || visit == NULL) return;
+    const Queue *q = (const Queue *)queue;
+    for (Node *node = q->head; node != NULL; node = node->next){
+        visit(node->content, arg);
+    }
+}
+ 
 /*
  * return: the number of stored items in the queue
  */
@@ -46,7 +46,8 @@ void* pop(void *queue);
 _Bool insert(void *queue, void *entry);
 
 /*
- * Erase all entries with the value entry, if such exists
+ * Erase all entries with the value entry, if such exists. The erased
+ * entries are released as in clear().
  * return: true on success; false to indicate no such value has been removed
  */
 _Bool erase(void *queue, void *entry);
@@ -61,6 +62,12 @@ _Bool erase(void *queue, void *entry);
  */
 void* getEntry(const void *queue, int idx);
  
+/*
+ * Call visit with every stored item and arg, from the head of the queue
+ * to the tail. The items may be changed but not removed by visit.
+ */
+void forEach(void *queue, void (*visit)(void *, void *), void *arg);
+
 /*
  * return: the number of stored items in the queue
  */
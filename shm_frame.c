@@ -0,0 +1,117 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_frame.h"
+
+static shm_frame_t *shm_frame_map(const char *channel, bool create);
+
+void shm_frame_name(const char *channel, char *name, size_t size){
+    size_t len = snprintf(name, size, "%s", SHM_FRAME_NAME_PREFIX);
+    for (const char *ch = channel; *ch != '\0' && len + 1 < size; ch++){
+        name[len++] = (*ch == '/' || *ch == ':') ? '_' : *ch; // segment name may contain only leading '/'
+    }
+    name[len < size ? len : size - 1] = '\0';
+}
+
+shm_frame_t *shm_frame_create(const char *channel){
+    return shm_frame_map(channel, true);
+}
+
+shm_frame_t *shm_frame_attach(const char *channel){
+    return shm_frame_map(channel, false);
+}
+
+static shm_frame_t *shm_frame_map(const char *channel, bool create){
+    shm_frame_t *frame = malloc(sizeof(shm_frame_t));
+    if (frame == NULL){
+        fprintf(stderr, "ERROR: Allocation of shared frame failed.\n");
+        return NULL;
+    }
+    shm_frame_name(channel, frame->name, sizeof(frame->name));
+    frame->owner = create;
+    frame->size = sizeof(shm_frame_header_t) + (size_t)SHM_FRAME_SLOTS * SHM_FRAME_SLOT_CAPACITY;
+
+    if (create) shm_unlink(frame->name); // leftover from a crashed module
+    int fd = shm_open(frame->name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd == -1){
+        fprintf(stderr, "WARN: Cannot open shared frame '%s': %s\n", frame->name, strerror(errno));
+        free(frame);
+        return NULL;
+    }
+    if (create && ftruncate(fd, frame->size) == -1){
+        fprintf(stderr, "WARN: Cannot resize shared frame '%s': %s\n", frame->name, strerror(errno));
+        close(fd);
+        shm_unlink(frame->name);
+        free(frame);
+        return NULL;
+    }
+    void *base = mmap(NULL, frame->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // mapping keeps the segment alive
+    if (base == MAP_FAILED){
+        fprintf(stderr, "WARN: Cannot map shared frame '%s': %s\n", frame->name, strerror(errno));
+        if (create) shm_unlink(frame->name);
+        free(frame);
+        return NULL;
+    }
+    frame->header = base;
+    frame->slots = (uint8_t *)base + sizeof(shm_frame_header_t);
+
+    if (create){
+        for (int i = 0; i < SHM_FRAME_SLOTS; i++){
+            atomic_store(&frame->header->slot_state[i], SHM_SLOT_FREE);
+        }
+        atomic_store(&frame->header->magic, SHM_FRAME_MAGIC);
+    } else if (atomic_load(&frame->header->magic) != SHM_FRAME_MAGIC){
+        fprintf(stderr, "WARN: Shared frame '%s' has not been initialized.\n", frame->name);
+        shm_frame_destroy(frame);
+        return NULL;
+    }
+    fprintf(stderr, "INFO: Shared frame '%s' (%zu bytes) mapped succesfully.\n", frame->name, frame->size);
+    return frame;
+}
+
+void shm_frame_destroy(shm_frame_t *frame){
+    if (frame == NULL) return;
+    munmap(frame->header, frame->size);
+    if (frame->owner) shm_unlink(frame->name);
+    free(frame);
+}
+
+void shm_frame_remove(const char *channel){
+    char name[SHM_FRAME_NAME_LENGTH];
+    shm_frame_name(channel, name, sizeof(name));
+    shm_unlink(name);
+}
+
+int shm_frame_acquire(shm_frame_t *frame, size_t length){
+    if (frame == NULL || length > SHM_FRAME_SLOT_CAPACITY) return -1;
+    for (int i = 0; i < SHM_FRAME_SLOTS; i++){
+        unsigned int expected = SHM_SLOT_FREE;
+        if (atomic_compare_exchange_strong(&frame->header->slot_state[i], &expected, SHM_SLOT_WRITING)){
+            return i;
+        }
+    }
+    return -1; // app is lagging behind, caller falls back to the pipe
+}
+
+uint8_t *shm_frame_slot(shm_frame_t *frame, int slot){
+    if (frame == NULL || slot < 0 || slot >= SHM_FRAME_SLOTS) return NULL;
+    return frame->slots + (size_t)slot * SHM_FRAME_SLOT_CAPACITY;
+}
+
+void shm_frame_publish(shm_frame_t *frame, int slot){
+    if (frame == NULL || slot < 0 || slot >= SHM_FRAME_SLOTS) return;
+    atomic_store(&frame->header->slot_state[slot], SHM_SLOT_READY);
+}
+
+void shm_frame_release(shm_frame_t *frame, int slot){
+    if (frame == NULL || slot < 0 || slot >= SHM_FRAME_SLOTS) return;
+    atomic_store(&frame->header->slot_state[slot], SHM_SLOT_FREE);
+}
@@ -0,0 +1,57 @@
+
+#ifndef __SHM_FRAME_H__
+#define __SHM_FRAME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Shared memory frame transport. The module creates a POSIX shared memory segment divided
+// into fixed size slots, workers compute iterations directly into a free slot and only a small
+// MSG_COMPUTE_DATA_SHM notification travels through the pipe. The app colours straight from
+// the slot and hands it back, so no iteration data is copied between the processes.
+
+#define SHM_FRAME_NAME_PREFIX "/prgsem"
+#define SHM_FRAME_NAME_LENGTH 64
+#define SHM_FRAME_MAGIC 0x50524753u // "PRGS"
+#define SHM_FRAME_SLOTS 32
+#define SHM_FRAME_SLOT_CAPACITY (256 * 1024) // bytes (= pixels) per slot
+
+enum {
+    SHM_SLOT_FREE,    // slot can be taken by a worker
+    SHM_SLOT_WRITING, // worker is computing into the slot
+    SHM_SLOT_READY,   // data are ready, notification was sent to the app
+};
+
+typedef struct {
+    atomic_uint magic;
+    atomic_uint slot_state[SHM_FRAME_SLOTS];
+} shm_frame_header_t;
+
+typedef struct {
+    shm_frame_header_t *header;
+    uint8_t *slots;
+    size_t size;
+    bool owner; // creator of the segment unlinks it
+    char name[SHM_FRAME_NAME_LENGTH];
+} shm_frame_t;
+
+// derives the segment name from the channel (pipe path) both processes know
+void shm_frame_name(const char *channel, char *name, size_t size);
+
+// creates (module side) or attaches (app side) the segment, returns NULL on failure
+shm_frame_t *shm_frame_create(const char *channel);
+shm_frame_t *shm_frame_attach(const char *channel);
+void shm_frame_destroy(shm_frame_t *frame);
+
+// removes the segment of a module that could not do it itself (crashed)
+void shm_frame_remove(const char *channel);
+
+// returns index of a slot reserved for writing or -1 if none is free or length does not fit
+int shm_frame_acquire(shm_frame_t *frame, size_t length);
+uint8_t *shm_frame_slot(shm_frame_t *frame, int slot);
+void shm_frame_publish(shm_frame_t *frame, int slot);
+void shm_frame_release(shm_frame_t *frame, int slot);
+
+#endif
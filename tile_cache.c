@@ -0,0 +1,190 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "tile_cache.h"
+#include "crc32c.h"
+
+static uint32_t tile_crc(const tile_key_t *key, const uint8_t *iters, uint32_t length);
+static tile_entry_t *tile_set(tile_cache_t *cache, const tile_key_t *key);
+static void tile_cache_lock(tile_cache_t *cache);
+static void tile_cache_unlock(tile_cache_t *cache);
+
+const char *tile_cache_default_path(void){
+    static char path[PATH_MAX];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir != NULL && *dir == '/'){
+        snprintf(path, sizeof(path), "%s/" TILE_CACHE_FILE, dir);
+    } else { // anyone can write to /tmp, the file is checked to be ours when it is opened
+        snprintf(path, sizeof(path), "/tmp/" TILE_CACHE_FILE "-%u", (unsigned)getuid());
+    }
+    return path;
+}
+
+void tile_key_init(tile_key_t *key, const msg_set_compute *setup, const msg_compute *chunk){
+    memset(key, 0, sizeof(tile_key_t));
+    key->c_re = setup->c_re;
+    key->c_im = setup->c_im;
+    key->d_re = setup->d_re;
+    key->d_im = setup->d_im;
+    key->re = chunk->re;
+    key->im = chunk->im;
+    key->n_re = chunk->n_re;
+    key->n_im = chunk->n_im;
+    key->n = setup->n;
+    key->kernel = KERNEL_JULIA;
+}
+
+tile_cache_t *tile_cache_open(const char *path){
+    if (path == NULL || strcmp(path, TILE_CACHE_DISABLED) == 0) return NULL;
+    tile_cache_t *cache = malloc(sizeof(tile_cache_t));
+    if (cache == NULL){
+        fprintf(stderr, "ERROR: Allocation of tile cache failed.\n");
+        return NULL;
+    }
+    uint32_t num_of_sets = TILE_CACHE_MAX_BYTES / 
+        (TILE_CACHE_WAYS * (TILE_CACHE_SLOT_BYTES + sizeof(tile_entry_t)));
+    size_t num_of_slots = (size_t)num_of_sets * TILE_CACHE_WAYS;
+    cache->size = sizeof(tile_cache_header_t) + num_of_slots * (sizeof(tile_entry_t) + TILE_CACHE_SLOT_BYTES);
+    cache->hits = cache->misses = 0;
+
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (cache->fd == -1){
+        fprintf(stderr, "WARN: Cannot open tile cache '%s': %s\n", path, strerror(errno));
+        free(cache);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(cache->fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != getuid()){
+        fprintf(stderr, "WARN: Tile cache '%s' is not a regular file of this user, chunks are not cached.\n",
+            path);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    flock(cache->fd, LOCK_EX); // other processes wait until the file is initialized
+    bool fresh = fstat(cache->fd, &st) == 0 && st.st_size == 0;
+    if (fresh && ftruncate(cache->fd, cache->size) == -1){
+        fprintf(stderr, "WARN: Cannot resize tile cache '%s': %s\n", path, strerror(errno));
+        flock(cache->fd, LOCK_UN);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    if (!fresh && (size_t)st.st_size != cache->size){ // truncating it would kill processes that map it
+        fprintf(stderr, "WARN: Tile cache '%s' has a different size, remove it to cache chunks.\n", path);
+        flock(cache->fd, LOCK_UN);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    void *base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (base == MAP_FAILED){
+        fprintf(stderr, "WARN: Cannot map tile cache '%s': %s\n", path, strerror(errno));
+        flock(cache->fd, LOCK_UN);
+        close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+    cache->header = base;
+    cache->entries = (tile_entry_t *)((uint8_t *)base + sizeof(tile_cache_header_t));
+    cache->slots = (uint8_t *)(cache->entries + num_of_slots);
+
+    tile_cache_header_t *header = cache->header;
+    if (header->magic != TILE_CACHE_MAGIC || header->version != TILE_CACHE_VERSION ||
+        header->num_of_sets != num_of_sets || header->slot_bytes != TILE_CACHE_SLOT_BYTES){
+        if (!fresh) fprintf(stderr, "INFO: Tile cache '%s' is not valid, starting an empty one.\n", path);
+        memset(cache->entries, 0, num_of_slots * sizeof(tile_entry_t));
+        header->version = TILE_CACHE_VERSION;
+        header->num_of_sets = num_of_sets;
+        header->slot_bytes = TILE_CACHE_SLOT_BYTES;
+        header->clock = 0;
+        header->magic = TILE_CACHE_MAGIC;
+    }
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_init(&cache->lock, NULL);
+    fprintf(stderr, "INFO: Tile cache '%s' (%zu bytes) mapped succesfully.\n", path, cache->size);
+    return cache;
+}
+
+void tile_cache_close(tile_cache_t *cache){
+    if (cache == NULL) return;
+    fprintf(stderr, "INFO: Tile cache had %u hits and %u misses.\n", cache->hits, cache->misses);
+    munmap(cache->header, cache->size);
+    close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+bool tile_cache_lookup(tile_cache_t *cache, const tile_key_t *key, uint8_t *iters, uint32_t length){
+    if (cache == NULL || length > TILE_CACHE_SLOT_BYTES) return false;
+    bool found = false;
+    tile_cache_lock(cache);
+    tile_entry_t *set = tile_set(cache, key);
+    for (int way = 0; way < TILE_CACHE_WAYS && !found; way++){
+        tile_entry_t *entry = &set[way];
+        if (entry->length != length || memcmp(&entry->key, key, sizeof(tile_key_t)) != 0) continue;
+        const uint8_t *slot = cache->slots + (size_t)(entry - cache->entries) * TILE_CACHE_SLOT_BYTES;
+        if (tile_crc(key, slot, length) != entry->crc){
+            entry->length = 0; // damaged, the slot is free again
+            continue;
+        }
+        memcpy(iters, slot, length);
+        entry->last_used = ++cache->header->clock;
+        found = true;
+    }
+    found ? cache->hits++ : cache->misses++;
+    tile_cache_unlock(cache);
+    return found;
+}
+
+void tile_cache_store(tile_cache_t *cache, const tile_key_t *key, const uint8_t *iters, uint32_t length){
+    if (cache == NULL || length == 0 || length > TILE_CACHE_SLOT_BYTES) return;
+    tile_cache_lock(cache);
+    tile_entry_t *set = tile_set(cache, key), *victim = &set[0];
+    for (int way = 0; way < TILE_CACHE_WAYS; way++){
+        tile_entry_t *entry = &set[way];
+        if (entry->length == length && memcmp(&entry->key, key, sizeof(tile_key_t)) == 0){
+            entry->last_used = ++cache->header->clock; // stored by another process meanwhile
+            tile_cache_unlock(cache);
+            return;
+        }
+        if (entry->length == 0 && victim->length != 0) victim = entry;
+        if (victim->length != 0 && entry->last_used < victim->last_used) victim = entry;
+    }
+    uint8_t *slot = cache->slots + (size_t)(victim - cache->entries) * TILE_CACHE_SLOT_BYTES;
+    victim->length = 0; // invalid until everything is written
+    memcpy(slot, iters, length);
+    victim->key = *key;
+    victim->crc = tile_crc(key, iters, length);
+    victim->last_used = ++cache->header->clock;
+    victim->length = length;
+    tile_cache_unlock(cache);
+}
+
+static uint32_t tile_crc(const tile_key_t *key, const uint8_t *iters, uint32_t length){
+    return crc32c_final(crc32c_update(crc32c_update(CRC32C_INIT, key, sizeof(tile_key_t)), iters, length));
+}
+
+static tile_entry_t *tile_set(tile_cache_t *cache, const tile_key_t *key){
+    uint32_t set = crc32c(key, sizeof(tile_key_t)) % cache->header->num_of_sets;
+    return cache->entries + (size_t)set * TILE_CACHE_WAYS;
+}
+
+static void tile_cache_lock(tile_cache_t *cache){
+    pthread_mutex_lock(&cache->lock);
+    flock(cache->fd, LOCK_EX);
+}
+
+static void tile_cache_unlock(tile_cache_t *cache){
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,74 @@
+
+#ifndef __TILE_CACHE_H__
+#define __TILE_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "messages.h"
+
+// Persistent cache of computed chunks. The counts are kept in a memory mapped file, so a view
+// that has been computed once, in this run or any earlier one, by the app or by a module, is
+// read back instead of being computed again. A chunk is found by the exact parameters it was
+// computed with, the file is locked while it is read or written, so several processes share it.
+
+#define TILE_CACHE_FILE "prgsem_tile_cache" // in $XDG_RUNTIME_DIR, or in /tmp with the uid appended
+#define TILE_CACHE_DISABLED "none"        // given instead of the path, nothing is cached
+#define TILE_CACHE_MAGIC 0x50524754u      // "PRGT"
+#define TILE_CACHE_VERSION 1
+#define TILE_CACHE_MAX_BYTES (64 * 1024 * 1024) // size of the file
+#define TILE_CACHE_SLOT_BYTES (16 * 1024) // larger chunks are not cached
+#define TILE_CACHE_WAYS 8                 // slots a chunk can be stored in, the least recently used is replaced
+
+typedef struct {
+    double c_re, c_im;   // constant of the recursive equation
+    double d_re, d_im;   // pixel size
+    double re, im;       // lower left corner of the chunk
+    uint16_t n_re, n_im; // chunk size in pixels
+    uint8_t n;           // number of iterations
+    uint8_t kernel;      // KERNEL_* the counts were computed by
+    uint8_t pad[2];      // zero, keys are compared bytewise
+} tile_key_t;
+
+typedef struct {
+    tile_key_t key;
+    uint32_t length;     // bytes of the counts, 0 if the slot is empty
+    uint32_t crc;        // of the key and the counts, a chunk half written by a killed process does not match
+    uint64_t last_used;  // clock of the cache when it was stored or found
+} tile_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_of_sets;
+    uint32_t slot_bytes;
+    uint64_t clock;      // advanced by every lookup and store
+} tile_cache_header_t;
+
+typedef struct {
+    int fd;
+    size_t size;
+    tile_cache_header_t *header;
+    tile_entry_t *entries; // TILE_CACHE_WAYS per set
+    uint8_t *slots;
+    pthread_mutex_t lock;  // flock() does not exclude threads sharing the descriptor
+    unsigned hits, misses;
+} tile_cache_t;
+
+void tile_key_init(tile_key_t *key, const msg_set_compute *setup, const msg_compute *chunk);
+
+// path of the file used unless another is given
+const char *tile_cache_default_path(void);
+
+// maps the file, creates it if it does not exist. Returns NULL on failure or for TILE_CACHE_DISABLED,
+// the caller then computes everything. Only a regular file of the current user is mapped.
+tile_cache_t *tile_cache_open(const char *path);
+void tile_cache_close(tile_cache_t *cache);
+
+// copies length counts of the chunk to iters, false if the chunk is not cached
+bool tile_cache_lookup(tile_cache_t *cache, const tile_key_t *key, uint8_t *iters, uint32_t length);
+void tile_cache_store(tile_cache_t *cache, const tile_key_t *key, const uint8_t *iters, uint32_t length);
+
+#endif
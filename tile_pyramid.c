@@ -0,0 +1,181 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tile_pyramid.h"
+
+static bool tile_id(const tile_key_t *key, int *level, int64_t *ix, int64_t *iy);
+static bool same_parameters(const tile_pyramid_t *pyramid, const tile_key_t *key);
+static pyramid_tile_t **bucket(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy);
+static pyramid_tile_t *find(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy);
+static void insert(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy, const uint8_t *iters);
+static void unlink_lru(tile_pyramid_t *pyramid, pyramid_tile_t *tile);
+static void link_newest(tile_pyramid_t *pyramid, pyramid_tile_t *tile);
+static void evict(tile_pyramid_t *pyramid, pyramid_tile_t *tile);
+static void clear(tile_pyramid_t *pyramid);
+
+void pyramid_init(tile_pyramid_t *pyramid){
+    memset(pyramid, 0, sizeof(tile_pyramid_t));
+    pthread_mutex_init(&pyramid->lock, NULL);
+}
+
+void pyramid_destroy(tile_pyramid_t *pyramid){
+    if (pyramid->hits > 0 || pyramid->assembled > 0){
+        fprintf(stderr, "INFO: Tile pyramid served %u tiles, %u of them put together from finer ones.\n",
+            pyramid->hits + pyramid->assembled, pyramid->assembled);
+    }
+    clear(pyramid);
+    pthread_mutex_destroy(&pyramid->lock);
+}
+
+bool pyramid_on_grid(const tile_key_t *key){
+    int level;
+    int64_t ix, iy;
+    return tile_id(key, &level, &ix, &iy);
+}
+
+bool pyramid_lookup(tile_pyramid_t *pyramid, const tile_key_t *key, uint8_t *iters){
+    int level;
+    int64_t ix, iy;
+    if (!tile_id(key, &level, &ix, &iy)) return false;
+    pthread_mutex_lock(&pyramid->lock);
+    if (!same_parameters(pyramid, key)){
+        pthread_mutex_unlock(&pyramid->lock);
+        return false;
+    }
+    int w = pyramid->tile_width, h = pyramid->tile_height;
+    pyramid_tile_t *tile = find(pyramid, level, ix, iy);
+    if (tile != NULL){
+        unlink_lru(pyramid, tile);
+        link_newest(pyramid, tile);
+        memcpy(iters, tile->iters, w * h);
+        pyramid->hits++;
+        pthread_mutex_unlock(&pyramid->lock);
+        return true;
+    }
+    pyramid_tile_t *finer[2][2]; // [row][col] of the tiles one level finer
+    for (int b = 0; b < 2; b++){
+        for (int a = 0; a < 2; a++){
+            if ((finer[b][a] = find(pyramid, level + 1, 2 * ix + a, 2 * iy + b)) == NULL){
+                pthread_mutex_unlock(&pyramid->lock);
+                return false;
+            }
+        }
+    }
+    for (int row = 0; row < h; row++){ // every other pixel of every other row
+        int fine_row = 2 * row, b = fine_row >= h;
+        for (int col = 0; col < w; col++){
+            int fine_col = 2 * col, a = fine_col >= w;
+            iters[row * w + col] = finer[b][a]->iters[(fine_row - b * h) * w + fine_col - a * w];
+        }
+    }
+    insert(pyramid, level, ix, iy, iters);
+    pyramid->assembled++;
+    pthread_mutex_unlock(&pyramid->lock);
+    return true;
+}
+
+void pyramid_store(tile_pyramid_t *pyramid, const tile_key_t *key, const uint8_t *iters){
+    int level;
+    int64_t ix, iy;
+    if (!tile_id(key, &level, &ix, &iy)) return;
+    pthread_mutex_lock(&pyramid->lock);
+    if (!same_parameters(pyramid, key)){
+        clear(pyramid);
+        pyramid->c_re = key->c_re;
+        pyramid->c_im = key->c_im;
+        pyramid->n = key->n;
+        pyramid->tile_width = key->n_re;
+        pyramid->tile_height = key->n_im;
+    }
+    pyramid_tile_t *tile = find(pyramid, level, ix, iy);
+    if (tile != NULL){
+        unlink_lru(pyramid, tile);
+        link_newest(pyramid, tile);
+    } else {
+        insert(pyramid, level, ix, iy, iters);
+    }
+    pthread_mutex_unlock(&pyramid->lock);
+}
+
+// snapped views have square pixels of 2^-level and chunks with the corner on the grid of the level
+static bool tile_id(const tile_key_t *key, int *level, int64_t *ix, int64_t *iy){
+    int exponent;
+    if (key->d_re != key->d_im || key->d_re <= 0 || key->n_re == 0 || key->n_im == 0 ||
+        (size_t)key->n_re * key->n_im > PYRAMID_MAX_TILE_BYTES || frexp(key->d_re, &exponent) != 0.5){
+        return false;
+    }
+    double tile_re = key->n_re * key->d_re, tile_im = key->n_im * key->d_im;
+    double x = floor(key->re / tile_re), y = floor(key->im / tile_im);
+    if (x * tile_re != key->re || y * tile_im != key->im) return false;
+    *level = 1 - exponent; // d = 2^(exponent - 1)
+    *ix = (int64_t)x;
+    *iy = (int64_t)y;
+    return true;
+}
+
+static bool same_parameters(const tile_pyramid_t *pyramid, const tile_key_t *key){
+    return pyramid->c_re == key->c_re && pyramid->c_im == key->c_im && pyramid->n == key->n &&
+        pyramid->tile_width == key->n_re && pyramid->tile_height == key->n_im;
+}
+
+static pyramid_tile_t **bucket(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy){
+    uint64_t hash = ((uint64_t)ix * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)iy * 0xc2b2ae3d27d4eb4full) ^
+        ((uint64_t)level * 0x165667b19e3779f9ull);
+    return &pyramid->buckets[(hash >> 32) % PYRAMID_BUCKETS];
+}
+
+static pyramid_tile_t *find(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy){
+    for (pyramid_tile_t *tile = *bucket(pyramid, level, ix, iy); tile != NULL; tile = tile->next){
+        if (tile->level == level && tile->ix == ix && tile->iy == iy) return tile;
+    }
+    return NULL;
+}
+
+static void insert(tile_pyramid_t *pyramid, int level, int64_t ix, int64_t iy, const uint8_t *iters){
+    size_t length = (size_t)pyramid->tile_width * pyramid->tile_height;
+    pyramid_tile_t *tile = malloc(sizeof(pyramid_tile_t) + length);
+    if (tile == NULL){
+        fprintf(stderr, "WARN: Allocation of a tile of the pyramid failed.\n");
+        return;
+    }
+    tile->level = level;
+    tile->ix = ix;
+    tile->iy = iy;
+    memcpy(tile->iters, iters, length);
+    pyramid_tile_t **head = bucket(pyramid, level, ix, iy);
+    tile->next = *head;
+    *head = tile;
+    link_newest(pyramid, tile);
+    pyramid->bytes += sizeof(pyramid_tile_t) + length;
+    while (pyramid->bytes > PYRAMID_MAX_BYTES && pyramid->oldest != tile){
+        evict(pyramid, pyramid->oldest);
+    }
+}
+
+static void unlink_lru(tile_pyramid_t *pyramid, pyramid_tile_t *tile){
+    if (tile->newer != NULL) tile->newer->older = tile->older; else pyramid->newest = tile->older;
+    if (tile->older != NULL) tile->older->newer = tile->newer; else pyramid->oldest = tile->newer;
+}
+
+static void link_newest(tile_pyramid_t *pyramid, pyramid_tile_t *tile){
+    tile->newer = NULL;
+    tile->older = pyramid->newest;
+    if (pyramid->newest != NULL) pyramid->newest->newer = tile; else pyramid->oldest = tile;
+    pyramid->newest = tile;
+}
+
+static void evict(tile_pyramid_t *pyramid, pyramid_tile_t *tile){
+    pyramid_tile_t **link = bucket(pyramid, tile->level, tile->ix, tile->iy);
+    while (*link != tile) link = &(*link)->next;
+    *link = tile->next;
+    unlink_lru(pyramid, tile);
+    pyramid->bytes -= sizeof(pyramid_tile_t) + (size_t)pyramid->tile_width * pyramid->tile_height;
+    free(tile);
+}
+
+static void clear(tile_pyramid_t *pyramid){
+    while (pyramid->oldest != NULL) evict(pyramid, pyramid->oldest);
+}
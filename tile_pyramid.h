@@ -0,0 +1,51 @@
+
+#ifndef __TILE_PYRAMID_H__
+#define __TILE_PYRAMID_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "tile_cache.h"
+
+// Chunks of snapped views kept in memory. A snapped view has the pixel size 2^-level and its chunks
+// lie on the grid of that level, tile (ix, iy) has its lower left corner at (ix * width, iy * height)
+// pixels. Every pixel of a tile is a pixel of the tile one level finer, so a tile missing after
+// zooming out is put together from the four finer tiles it covers.
+
+#define PYRAMID_MAX_BYTES (32 * 1024 * 1024) // tiles over the budget are evicted, least recently used first
+#define PYRAMID_MAX_TILE_BYTES (256 * 1024) // larger chunks are not kept
+#define PYRAMID_BUCKETS 4096
+
+typedef struct pyramid_tile {
+    int level;
+    int64_t ix, iy;
+    struct pyramid_tile *next;   // in the bucket
+    struct pyramid_tile *newer, *older;
+    uint8_t iters[];             // rows from the bottom up, as modules send them
+} pyramid_tile_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pyramid_tile_t *buckets[PYRAMID_BUCKETS];
+    pyramid_tile_t *newest, *oldest;
+    size_t bytes;
+    // tiles of other parameters are dropped when the first chunk of new ones is stored
+    double c_re, c_im;
+    uint8_t n;
+    uint16_t tile_width, tile_height;
+    unsigned hits, assembled;
+} tile_pyramid_t;
+
+void pyramid_init(tile_pyramid_t *pyramid);
+void pyramid_destroy(tile_pyramid_t *pyramid);
+
+// true if the chunk lies on the grid of some level and is small enough to be kept
+bool pyramid_on_grid(const tile_key_t *key);
+
+// copies the counts of the chunk to iters, false if neither it nor its four finer tiles are kept
+bool pyramid_lookup(tile_pyramid_t *pyramid, const tile_key_t *key, uint8_t *iters);
+void pyramid_store(tile_pyramid_t *pyramid, const tile_key_t *key, const uint8_t *iters);
+
+#endif
@@ -0,0 +1,275 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "transport.h"
+#include "event_loop.h"
+
+#define TRANSPORT_RETRY_MS 10
+
+static int unix_address(const char *channel, struct sockaddr_un *addr);
+static struct addrinfo *tcp_address(const char *channel, bool passive);
+static void set_socket_options(int fd, int kind);
+
+int transport_kind(const char *channel){
+    if (strncmp(channel, TRANSPORT_UNIX_PREFIX, strlen(TRANSPORT_UNIX_PREFIX)) == 0) return TRANSPORT_KIND_UNIX;
+    if (strncmp(channel, TRANSPORT_TCP_PREFIX, strlen(TRANSPORT_TCP_PREFIX)) == 0) return TRANSPORT_KIND_TCP;
+    if (strncmp(channel, TRANSPORT_FD_PREFIX, strlen(TRANSPORT_FD_PREFIX)) == 0) return TRANSPORT_KIND_FD;
+    if (strncmp(channel, TRANSPORT_SPAWN_PREFIX, strlen(TRANSPORT_SPAWN_PREFIX)) == 0 &&
+        (channel[strlen(TRANSPORT_SPAWN_PREFIX)] == '\0' || channel[strlen(TRANSPORT_SPAWN_PREFIX)] == ':')){
+        return TRANSPORT_KIND_SPAWN;
+    }
+    return TRANSPORT_KIND_PIPE;
+}
+
+int transport_listen(const char *channel){
+    int fd = -1;
+    if (transport_kind(channel) == TRANSPORT_KIND_UNIX){
+        struct sockaddr_un addr;
+        if (unix_address(channel, &addr) == -1) return -1;
+        unlink(addr.sun_path); // leftover from a crashed module
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 || 
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1){
+            fprintf(stderr, "ERROR: Cannot bind socket '%s': %s\n", channel, strerror(errno));
+            if (fd != -1) close(fd);
+            return -1;
+        }
+    } else {
+        struct addrinfo *info = tcp_address(channel, true);
+        if (info == NULL) return -1;
+        int yes = 1, err = 0;
+        for (struct addrinfo *a = info; a != NULL && fd == -1; a = a->ai_next){ // first one that binds
+            if ((fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) == -1 ||
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1 ||
+                bind(fd, a->ai_addr, a->ai_addrlen) == -1){
+                err = errno;
+                if (fd != -1) close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(info);
+        if (fd == -1){
+            fprintf(stderr, "ERROR: Cannot bind socket '%s': %s\n", channel, strerror(err));
+            return -1;
+        }
+    }
+    if (listen(fd, TRANSPORT_LISTEN_BACKLOG) == -1){
+        fprintf(stderr, "ERROR: Cannot listen on socket '%s': %s\n", channel, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fprintf(stderr, "INFO: Listening on '%s'.\n", channel);
+    return fd;
+}
+
+int transport_accept(int listen_fd, atomic_bool *quit){
+    struct sockaddr_storage addr;
+    event_loop_t loop;
+    int fd = -1;
+    if (!event_loop_init(&loop)) return -1;
+    event_loop_add(&loop, listen_fd, EVENT_INPUT);
+    while (!atomic_load(quit)){
+        if (!(event_loop_wait(&loop, -1) & EVENT_INPUT)) continue;
+        socklen_t len = sizeof(addr);
+        if ((fd = accept(listen_fd, (struct sockaddr *)&addr, &len)) == -1){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED){
+                fprintf(stderr, "ERROR: accept() failed: %s\n", strerror(errno));
+                break;
+            }
+            continue;
+        }
+        set_socket_options(fd, addr.ss_family == AF_UNIX ? TRANSPORT_KIND_UNIX : TRANSPORT_KIND_TCP);
+        break;
+    }
+    event_loop_destroy(&loop);
+    return fd;
+}
+
+int transport_connect(const char *channel, atomic_bool *quit){
+    int kind = transport_kind(channel);
+    struct sockaddr_un unix_addr;
+    struct addrinfo *info = NULL;
+    if (kind == TRANSPORT_KIND_UNIX ? unix_address(channel, &unix_addr) == -1 : 
+        (info = tcp_address(channel, false)) == NULL){
+        return -1;
+    }
+    struct addrinfo unix_info = {.ai_addr = (struct sockaddr *)&unix_addr, .ai_addrlen = sizeof(unix_addr)};
+    if (kind == TRANSPORT_KIND_UNIX) info = &unix_info;
+
+    int fd = -1, err = 0;
+    bool reported = false;
+    while (!atomic_load(quit)){
+        bool retry = false; // some address has nobody listening yet
+        // every address of the host is tried, the module may listen on any of them
+        for (struct addrinfo *a = info; a != NULL && fd == -1; a = a->ai_next){
+            if ((fd = socket(a->ai_addr->sa_family, SOCK_STREAM, 0)) != -1 && 
+                connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+            err = errno;
+            retry |= err == ECONNREFUSED || err == ENOENT || err == EAGAIN || err == EINTR;
+            if (fd != -1) close(fd);
+            fd = -1;
+        }
+        if (fd != -1) break;
+        if (!retry){
+            fprintf(stderr, "ERROR: Cannot connect to '%s': %s\n", channel, strerror(err));
+            break;
+        }
+        if (!reported){
+            fprintf(stderr, "INFO: Waiting for module to listen on '%s'\n", channel);
+            reported = true;
+        }
+        usleep(TRANSPORT_RETRY_MS * 1000);
+    }
+    if (kind != TRANSPORT_KIND_UNIX) freeaddrinfo(info);
+    if (fd != -1) set_socket_options(fd, kind);
+    return fd;
+}
+
+void transport_close_listener(int listen_fd, const char *channel){
+    if (listen_fd == -1) return;
+    close(listen_fd);
+    struct sockaddr_un addr;
+    if (transport_kind(channel) == TRANSPORT_KIND_UNIX && unix_address(channel, &addr) == 0){
+        unlink(addr.sun_path);
+    }
+}
+
+pid_t transport_spawn(const char *channel, const char *path, int *fd){
+    // everything the child needs is prepared before fork(), other threads may hold malloc() locks
+    const char *workers = channel[strlen(TRANSPORT_SPAWN_PREFIX)] == ':' ? 
+        channel + strlen(TRANSPORT_SPAWN_PREFIX) + 1 : "";
+    char workers_arg[16], fd_arg[sizeof(TRANSPORT_FD_PREFIX) + 12];
+    snprintf(workers_arg, sizeof(workers_arg), "%s", *workers != '\0' ? workers : "0"); // 0 = default
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1){
+        fprintf(stderr, "ERROR: socketpair() failed: %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(fd_arg, sizeof(fd_arg), TRANSPORT_FD_PREFIX "%d", sv[1]);
+    char *const argv[] = {(char *)path, workers_arg, fd_arg, fd_arg, NULL};
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC); // keyboard belongs to the app
+
+    pid_t pid = fork();
+    if (pid == 0){
+        if (null_fd != -1) dup2(null_fd, STDIN_FILENO);
+        fcntl(sv[1], F_SETFD, 0); // the only descriptor the module inherits
+        execv(path, argv);
+        _exit(127);
+    }
+    if (null_fd != -1) close(null_fd);
+    close(sv[1]);
+    if (pid == -1){
+        fprintf(stderr, "ERROR: fork() failed: %s\n", strerror(errno));
+        close(sv[0]);
+        return -1;
+    }
+    set_socket_options(sv[0], TRANSPORT_KIND_UNIX);
+    fprintf(stderr, "INFO: Started module '%s' (pid %d).\n", path, (int)pid);
+    *fd = sv[0];
+    return pid;
+}
+
+bool transport_reap(pid_t pid, int timeout_ms){
+    int status;
+    pid_t r;
+    for (int waited = 0; (r = waitpid(pid, &status, WNOHANG)) == 0; waited += TRANSPORT_RETRY_MS){
+        if (waited >= timeout_ms){
+            fprintf(stderr, "WARN: Module (pid %d) does not exit, killing it.\n", (int)pid);
+            kill(pid, SIGKILL);
+            r = waitpid(pid, &status, 0);
+            break;
+        }
+        usleep(TRANSPORT_RETRY_MS * 1000);
+    }
+    if (r == -1){
+        fprintf(stderr, "ERROR: waitpid() of module (pid %d) failed: %s\n", (int)pid, strerror(errno));
+        return false;
+    }
+    if (WIFEXITED(status)){
+        fprintf(stderr, "INFO: Module (pid %d) exited with %d.\n", (int)pid, WEXITSTATUS(status));
+        return WEXITSTATUS(status) == 0;
+    }
+    fprintf(stderr, "WARN: Module (pid %d) was killed by signal %d.\n", (int)pid, 
+        WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+    return false;
+}
+
+int transport_inherited(const char *channel){
+    char *end;
+    long fd = strtol(channel + strlen(TRANSPORT_FD_PREFIX), &end, 10);
+    int type;
+    socklen_t len = sizeof(type);
+    if (*end != '\0' || fd < 0 || fd > INT_MAX || 
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 || type != SOCK_STREAM){
+        fprintf(stderr, "ERROR: '%s' is not an inherited stream socket.\n", channel);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    set_socket_options(fd, TRANSPORT_KIND_UNIX);
+    return fd;
+}
+
+void transport_spawn_name(pid_t pid, char *name, size_t size){
+    snprintf(name, size, "spawned-%d", (int)pid);
+}
+
+static int unix_address(const char *channel, struct sockaddr_un *addr){
+    const char *path = channel + strlen(TRANSPORT_UNIX_PREFIX);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (*path == '\0' || strlen(path) >= sizeof(addr->sun_path)){
+        fprintf(stderr, "ERROR: Invalid Unix socket path '%s'.\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// "tcp:host:port", the port follows the last colon so that "tcp:[::1]:port" style hosts are not needed
+static struct addrinfo *tcp_address(const char *channel, bool passive){
+    const char *spec = channel + strlen(TRANSPORT_TCP_PREFIX);
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || colon[1] == '\0'){
+        fprintf(stderr, "ERROR: TCP channel '%s' has to be tcp:host:port.\n", channel);
+        return NULL;
+    }
+    char host[256];
+    size_t host_len = colon - spec;
+    if (host_len >= sizeof(host)){
+        fprintf(stderr, "ERROR: Host name in '%s' is too long.\n", channel);
+        return NULL;
+    }
+    memcpy(host, spec, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, 
+        .ai_flags = passive ? AI_PASSIVE : 0}, *info;
+    int r = getaddrinfo(host_len > 0 ? host : NULL, colon + 1, &hints, &info);
+    if (r != 0){
+        fprintf(stderr, "ERROR: Cannot resolve '%s': %s\n", channel, gai_strerror(r));
+        return NULL;
+    }
+    return info;
+}
+
+// small messages (MSG_DONE, MSG_COMPUTE) must not wait for Nagle's algorithm
+static void set_socket_options(int fd, int kind){
+    if (kind == TRANSPORT_KIND_TCP){
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
@@ -0,0 +1,60 @@
+
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Stream socket transports used instead of the named pipes when the channel name has a prefix:
+//   unix:/path/to/socket   - Unix-domain stream socket
+//   tcp:host:port          - TCP, the module may run on another host (empty host = any/localhost)
+// The module is the listening side, the app connects. One socket carries both directions.
+// Or the app starts the module itself over a socketpair(), nobody waits for anybody:
+//   spawn[:workers]        - app forks computational_module_exec (only in the app's channel list)
+//   fd:N                   - module talks over the inherited descriptor N (given by the app)
+
+#define TRANSPORT_UNIX_PREFIX "unix:"
+#define TRANSPORT_TCP_PREFIX "tcp:"
+#define TRANSPORT_SPAWN_PREFIX "spawn"
+#define TRANSPORT_FD_PREFIX "fd:"
+#define TRANSPORT_LISTEN_BACKLOG 1
+#define TRANSPORT_REAP_TIMEOUT_MS 1000 // spawned module gets this long to exit before SIGKILL
+
+enum {
+    TRANSPORT_KIND_PIPE,
+    TRANSPORT_KIND_UNIX,
+    TRANSPORT_KIND_TCP,
+    TRANSPORT_KIND_SPAWN,
+    TRANSPORT_KIND_FD,
+};
+
+int transport_kind(const char *channel);
+
+// returns listening socket or -1 on failure
+int transport_listen(const char *channel);
+
+// waits for the app to connect, returns -1 if quit is raised or on failure
+int transport_accept(int listen_fd, atomic_bool *quit);
+
+// connects to the listening module, retries until the module is up, returns -1 if quit is raised
+int transport_connect(const char *channel, atomic_bool *quit);
+
+// closes the listening socket and removes the Unix-domain socket file
+void transport_close_listener(int listen_fd, const char *channel);
+
+// forks and execs the module at path, returns its pid and the app's end of the socketpair in fd,
+// or -1 on failure
+pid_t transport_spawn(const char *channel, const char *path, int *fd);
+
+// waits for the spawned module to exit, kills it after timeout_ms, returns false if it has failed
+bool transport_reap(pid_t pid, int timeout_ms);
+
+// descriptor given to the module in "fd:N", -1 if it is not an open socket
+int transport_inherited(const char *channel);
+
+// the shared frame of a spawned module is named after its pid, both sides know it
+void transport_spawn_name(pid_t pid, char *name, size_t size);
+
+#endif
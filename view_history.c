@@ -0,0 +1,117 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "view_history.h"
+#include "burst_codec.h"
+
+#define HISTORY_CODECS ((1 << CODEC_RLE) | (1 << CODEC_DELTA))
+
+static void drop_oldest(view_history_t *history, int stack);
+
+void history_init(view_history_t *history){
+    memset(history, 0, sizeof(view_history_t));
+}
+
+void history_destroy(view_history_t *history){
+    for (int stack = 0; stack < HISTORY_NBR; stack++){
+        history_clear(history, stack);
+    }
+    free(history->scratch);
+}
+
+uint8_t *history_scratch(view_history_t *history, size_t length){
+    if (length > history->scratch_length){
+        uint8_t *grown = realloc(history->scratch, length);
+        if (grown == NULL){
+            fprintf(stderr, "WARN: Allocation of the frame of the view history failed.\n");
+            return NULL;
+        }
+        history->scratch = grown;
+        history->scratch_length = length;
+    }
+    return history->scratch;
+}
+
+void history_push(view_history_t *history, int stack, const history_view_t *view, const uint8_t *iters,
+    const bool *known){
+    size_t length = (size_t)view->width * view->height;
+    int num_of_chunks = (view->width / view->chunk_width) * (view->height / view->chunk_height);
+    history_view_t entry = *view;
+    entry.packed = malloc(length > 0 ? length : 1);
+    entry.known = malloc(num_of_chunks > 0 ? num_of_chunks * sizeof(bool) : 1);
+    if (entry.packed == NULL || entry.known == NULL){
+        fprintf(stderr, "WARN: Allocation of the frame of the view history failed.\n");
+        free(entry.packed);
+        free(entry.known);
+        return;
+    }
+    entry.codec = length > 1 ? codec_encode_best(iters, length, entry.packed, length - 1, &entry.packed_length,
+        HISTORY_CODECS) : CODEC_RAW;
+    if (entry.codec == CODEC_RAW){
+        memcpy(entry.packed, iters, length);
+        entry.packed_length = length;
+    } else {
+        uint8_t *shrunk = realloc(entry.packed, entry.packed_length);
+        if (shrunk != NULL) entry.packed = shrunk;
+    }
+    memcpy(entry.known, known, num_of_chunks * sizeof(bool));
+    entry.bytes = entry.packed_length + num_of_chunks * sizeof(bool);
+
+    if (history->num_of_views[stack] == HISTORY_MAX_VIEWS) drop_oldest(history, stack);
+    history->views[stack][history->num_of_views[stack]++] = entry;
+    history->bytes += entry.bytes;
+    while (history->bytes > HISTORY_MAX_BYTES){ // views furthest from the current one go first
+        int other = stack == HISTORY_BACK ? HISTORY_FORWARD : HISTORY_BACK;
+        if (history->num_of_views[other] > 0){
+            drop_oldest(history, other);
+        } else if (history->num_of_views[stack] > 1){
+            drop_oldest(history, stack);
+        } else {
+            break;
+        }
+    }
+}
+
+const history_view_t *history_top(const view_history_t *history, int stack){
+    int n = history->num_of_views[stack];
+    return n > 0 ? &history->views[stack][n - 1] : NULL;
+}
+
+bool history_pop(view_history_t *history, int stack, uint8_t *iters, bool *known){
+    if (history->num_of_views[stack] == 0) return false;
+    history_view_t *view = &history->views[stack][--history->num_of_views[stack]];
+    size_t length = (size_t)view->width * view->height;
+    int num_of_chunks = (view->width / view->chunk_width) * (view->height / view->chunk_height);
+    bool ok = true;
+    if (iters != NULL){
+        if (view->codec == CODEC_RAW){
+            memcpy(iters, view->packed, length);
+        } else if (!codec_decode(view->codec, view->packed, view->packed_length, iters, length)){
+            fprintf(stderr, "WARN: Decoding the frame of the view history failed.\n");
+            memset(iters, 0, length);
+            ok = false;
+        }
+    }
+    if (known != NULL){
+        if (ok) memcpy(known, view->known, num_of_chunks * sizeof(bool));
+        else memset(known, 0, num_of_chunks * sizeof(bool));
+    }
+    history->bytes -= view->bytes;
+    free(view->packed);
+    free(view->known);
+    return true;
+}
+
+void history_clear(view_history_t *history, int stack){
+    while (history_pop(history, stack, NULL, NULL));
+}
+
+static void drop_oldest(view_history_t *history, int stack){
+    history_view_t *views = history->views[stack];
+    history->bytes -= views[0].bytes;
+    free(views[0].packed);
+    free(views[0].known);
+    memmove(&views[0], &views[1], (--history->num_of_views[stack]) * sizeof(history_view_t));
+}
@@ -0,0 +1,64 @@
+
+#ifndef __VIEW_HISTORY_H__
+#define __VIEW_HISTORY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <complex.h>
+
+// Views the user has left, with the counts of their frames, so going back or forward shows the
+// frame at once and only the chunks that were not finished are computed again. Frames are kept
+// compressed by the codecs of the burst messages.
+
+#define HISTORY_MAX_VIEWS 32               // per stack
+#define HISTORY_MAX_BYTES (16 * 1024 * 1024) // oldest views are dropped over the budget
+
+enum {
+    HISTORY_BACK,
+    HISTORY_FORWARD,
+    HISTORY_NBR
+};
+
+typedef struct {
+    complex double lower_left_corner, upper_right_corner;
+    complex double constant;     // of the recursive equation
+    uint8_t num_of_iterations;
+    uint16_t width, height;      // of the frame
+    uint16_t chunk_width, chunk_height;
+    // filled in by history_push()
+    uint8_t codec;               // CODEC_*
+    size_t packed_length;
+    uint8_t *packed;             // counts of the frame
+    bool *known;                 // chunks whose counts were final
+    size_t bytes;                // memory the view takes
+} history_view_t;
+
+typedef struct {
+    history_view_t views[HISTORY_NBR][HISTORY_MAX_VIEWS]; // top of the stack is the last one
+    int num_of_views[HISTORY_NBR];
+    size_t bytes;
+    uint8_t *scratch;            // frame copied to be pushed, on the heap as it may be large
+    size_t scratch_length;
+} view_history_t;
+
+void history_init(view_history_t *history);
+void history_destroy(view_history_t *history);
+
+// puts the view with its frame on top of the stack, iters have width * height counts and known one
+// flag per chunk
+void history_push(view_history_t *history, int stack, const history_view_t *view, const uint8_t *iters,
+    const bool *known);
+
+// buffer of length bytes that history_push() may be given as iters, NULL if allocation fails
+uint8_t *history_scratch(view_history_t *history, size_t length);
+
+// view on top of the stack, NULL if it is empty
+const history_view_t *history_top(const view_history_t *history, int stack);
+
+// removes the view on top of the stack, its frame is decompressed to iters and known unless they are NULL
+bool history_pop(view_history_t *history, int stack, uint8_t *iters, bool *known);
+
+void history_clear(view_history_t *history, int stack);
+
+#endif
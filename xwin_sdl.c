@@ -5,6 +5,12 @@
  */
 
 #include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XWIN_SSSE3 // picked at run time if the CPU has it
+#include <tmmintrin.h>
+#endif
 
 #include <SDL.h>
 
@@ -49,6 +55,22 @@ static unsigned char icon_32x32_bits[] = {
    0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x1f, 0x00, 0x01, 0x24, 0x00, 0x01, 0x2a, 0x00, 0x01, 0x2f, 0x00, 0x02, 0x33, 0x00, 0x02, 0x35, 0x00, 0x02, 0x37, 0x00, 0x02, 0x36, 0x00, 0x02, 0x34, 0x00, 0x01, 0x30, 0x00, 0x01, 0x2b, 0x00, 0x01, 0x25, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21, 0x00, 0x00, 0x21
 };
 
+static void blit_row_generic(Uint8 *px, const unsigned char *src, int n);
+static void blit_row_rgb24(Uint8 *px, const unsigned char *src, int n);
+static void blit_row_32(Uint8 *px, const unsigned char *src, int n);
+static void blit_row_xrgb(Uint8 *px, const unsigned char *src, int n);
+#ifdef XWIN_SSSE3
+static void blit_row_xrgb_ssse3(Uint8 *px, const unsigned char *src, int n);
+#endif
+static void pick_blitter(const SDL_PixelFormat *format);
+
+// converts n pixels of the RGB image into the format of the window surface
+typedef void (*blit_row_t)(Uint8 *px, const unsigned char *src, int n);
+
+static blit_row_t blit_row = NULL;
+static Uint32 blit_format;     // surface format blit_row was picked for
+static const SDL_PixelFormat *generic_format; // shifts used by blit_row_generic
+
 int xwin_init(int w, int h)
 {
    int r;
@@ -60,6 +82,7 @@ int xwin_init(int w, int h)
    SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(icon_32x32_bits, 32, 32, 24, 32*3, 0xff, 0xff00, 0xff0000, 0x0000);
    SDL_SetWindowIcon(win, surface);
    SDL_FreeSurface(surface);
+   pick_blitter(SDL_GetWindowSurface(win)->format);
    return r;
 }
 
@@ -74,22 +97,121 @@ void xwin_redraw(int w, int h, unsigned char *img)
 {
    assert(img && win);
    SDL_Surface *scr = SDL_GetWindowSurface(win);
-   for(int y = 0; y < scr->h; ++y) {
-      for(int x = 0; x < scr->w; ++x) {
-         const int idx = (y * scr->w + x) * scr->format->BytesPerPixel;
-         Uint8 *px = (Uint8*)scr->pixels + idx;
-         *(px + scr->format->Rshift / 8) = *(img++);
-         *(px + scr->format->Gshift / 8) = *(img++);
-         *(px + scr->format->Bshift / 8) = *(img++);
-      }
+   if (scr->format->format != blit_format || blit_row == NULL) {
+      pick_blitter(scr->format); // surface is recreated when the window is resized
+   }
+   const int rows = h < scr->h ? h : scr->h;
+   const int cols = w < scr->w ? w : scr->w;
+   for(int y = 0; y < rows; ++y) {
+      blit_row((Uint8*)scr->pixels + y * scr->pitch, img + y * w * 3, cols);
    }
    SDL_UpdateWindowSurface(win);
 }
 
+void xwin_redraw_rects(int w, int h, unsigned char *img, const xwin_rect_t *rects, int n)
+{
+   assert(img && win);
+   SDL_Surface *scr = SDL_GetWindowSurface(win);
+   SDL_Rect updated[n > 0 ? n : 1];
+   int count = 0;
+   if (scr->format->format != blit_format || blit_row == NULL) {
+      pick_blitter(scr->format);
+   }
+   const int bpp = scr->format->BytesPerPixel;
+   for(int i = 0; i < n; ++i) {
+      int x = rects[i].x, y = rects[i].y, rect_w = rects[i].w, rect_h = rects[i].h;
+      // clip to both the image and the window
+      if (x < 0) { rect_w += x; x = 0; }
+      if (y < 0) { rect_h += y; y = 0; }
+      if (x + rect_w > w) rect_w = w - x;
+      if (y + rect_h > h) rect_h = h - y;
+      if (x + rect_w > scr->w) rect_w = scr->w - x;
+      if (y + rect_h > scr->h) rect_h = scr->h - y;
+      if (rect_w <= 0 || rect_h <= 0) {
+         continue;
+      }
+      for(int row = y; row < y + rect_h; ++row) {
+         blit_row((Uint8*)scr->pixels + row * scr->pitch + x * bpp, img + (row * w + x) * 3, rect_w);
+      }
+      updated[count++] = (SDL_Rect){ x, y, rect_w, rect_h };
+   }
+   if (count > 0) {
+      SDL_UpdateWindowSurfaceRects(win, updated, count);
+   }
+}
+
 void xwin_poll_events(void) 
 {
    SDL_Event event;
    while (SDL_PollEvent(&event));
 }
 
+static void pick_blitter(const SDL_PixelFormat *format)
+{
+   const int r = format->Rshift, g = format->Gshift, b = format->Bshift;
+   blit_format = format->format;
+   generic_format = format;
+   if (format->BytesPerPixel == 3 && r == 0 && g == 8 && b == 16) {
+      blit_row = blit_row_rgb24; // same byte order as the image
+   } else if (format->BytesPerPixel == 4 && r == 16 && g == 8 && b == 0) {
+      blit_row = blit_row_xrgb;  // XRGB8888 and ARGB8888, the usual window surface
+#ifdef XWIN_SSSE3
+      if (__builtin_cpu_supports("ssse3")) {
+         blit_row = blit_row_xrgb_ssse3;
+      }
+#endif
+   } else if (format->BytesPerPixel == 4 && r % 8 == 0 && g % 8 == 0 && b % 8 == 0) {
+      blit_row = blit_row_32;
+   } else {
+      blit_row = blit_row_generic;
+   }
+}
+
+static void blit_row_generic(Uint8 *px, const unsigned char *src, int n)
+{
+   const SDL_PixelFormat *f = generic_format;
+   for(int col = 0; col < n; ++col, px += f->BytesPerPixel) {
+      *(px + f->Rshift / 8) = *(src++);
+      *(px + f->Gshift / 8) = *(src++);
+      *(px + f->Bshift / 8) = *(src++);
+   }
+}
+
+static void blit_row_rgb24(Uint8 *px, const unsigned char *src, int n)
+{
+   memcpy(px, src, n * 3);
+}
+
+static void blit_row_32(Uint8 *px, const unsigned char *src, int n)
+{
+   const int r = generic_format->Rshift, g = generic_format->Gshift, b = generic_format->Bshift;
+   Uint32 *dst = (Uint32*)px;
+   for(int col = 0; col < n; ++col, src += 3) {
+      dst[col] = (Uint32)src[0] << r | (Uint32)src[1] << g | (Uint32)src[2] << b;
+   }
+}
+
+static void blit_row_xrgb(Uint8 *px, const unsigned char *src, int n)
+{
+   Uint32 *dst = (Uint32*)px;
+   for(int col = 0; col < n; ++col, src += 3) {
+      dst[col] = (Uint32)src[0] << 16 | (Uint32)src[1] << 8 | src[2];
+   }
+}
+
+#ifdef XWIN_SSSE3
+// 4 pixels per shuffle, every 16 byte load has 4 bytes of the next pixels the shuffle drops
+__attribute__((target("ssse3")))
+static void blit_row_xrgb_ssse3(Uint8 *px, const unsigned char *src, int n)
+{
+   const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+   int col = 0;
+   for(; col + 6 <= n; col += 4, src += 12, px += 16) { // the load must not read past the row
+      __m128i rgb = _mm_loadu_si128((const __m128i*)src);
+      _mm_storeu_si128((__m128i*)px, _mm_shuffle_epi8(rgb, shuffle));
+   }
+   blit_row_xrgb(px, src, n - col);
+}
+#endif
+
 /* end of xwin_sdl.c */
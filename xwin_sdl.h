@@ -10,6 +10,12 @@
 int xwin_init(int w, int h);
 void xwin_close(void);
 void xwin_redraw(int w, int h, unsigned char *img);
+typedef struct {
+   int x, y, w, h;
+} xwin_rect_t;
+
+// converts and presents only the given rectangles of the w x h image
+void xwin_redraw_rects(int w, int h, unsigned char *img, const xwin_rect_t *rects, int n);
 void xwin_poll_events(void);
 
 #endif